@@ -0,0 +1,83 @@
+#include "benchmark/benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "mcts/search.h"
+#include "neural/factory.h"
+#include "soko/levels.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+
+namespace pzero {
+
+  namespace {
+
+    const OptionId kThreadsId{"threads", "Threads",
+      "Largest number of search threads. Searches run with 1, 2, 4... "
+      "threads up to it.", 't'};
+
+    const OptionId kMoveTimeId{"movetime", "MoveTime",
+      "Time of every search in milliseconds."};
+
+  } // namespace
+
+  void Benchmark::Run() {
+    OptionsParser options;
+    NetworkFactory::PopulateOptions(&options);
+    SearchParams::Populate(&options);
+    LevelCollection::PopulateLevelOptions(&options);
+    options.Add<IntOption>(kThreadsId, 1, 128) = 1;
+    options.Add<IntOption>(kMoveTimeId, 1, 3600000) = 5000;
+
+    if (!options.ProcessAllFlags()) return;
+
+    try {
+      const auto option_dict = options.GetOptionsDict();
+
+      const auto fen = LevelCollection::GetFen(option_dict);
+
+      const auto network = NetworkFactory::LoadNetwork(option_dict);
+      const int max_threads = option_dict.Get<int>(kThreadsId.GetId());
+      const auto movetime = std::chrono::milliseconds(
+        option_dict.Get<int>(kMoveTimeId.GetId()));
+
+      // Speedups beyond the number of cores can't be expected.
+      std::cout << "hardware threads " << std::thread::hardware_concurrency()
+                << std::endl;
+
+      double base_nps = 0.0;
+      for (int threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        NodeTree tree;
+        tree.ResetToPosition(fen, {});
+
+        SearchLimits limits;
+        const auto start = std::chrono::steady_clock::now();
+        limits.search_deadline = start + movetime;
+        Search search(tree, network.get(), [](const BestMoveInfo&) {},
+                      limits, option_dict);
+        search.RunBlocking(threads);
+
+        const auto elapsed = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - start).count();
+        const auto nodes = tree.GetCurrentHead()->GetN();
+        const double nps = nodes / std::max(elapsed, 1e-6);
+        if (threads == 1) base_nps = nps;
+
+        std::cout << "threads " << threads << " nodes " << nodes
+                  << " time " << static_cast<int>(elapsed * 1000)
+                  << "ms nps " << static_cast<std::uint64_t>(nps)
+                  << " nps/thread " << static_cast<std::uint64_t>(nps / threads)
+                  << " speedup " << std::fixed << std::setprecision(2)
+                  << nps / std::max(base_nps, 1e-6) << std::endl;
+
+        if (threads == max_threads) break;
+      }
+    } catch (Exception& ex) {
+      std::cerr << ex.what() << std::endl;
+    }
+  }
+
+} // namespace pzero
@@ -0,0 +1,13 @@
+#pragma once
+
+namespace pzero {
+
+  // Searches a level for a fixed time with a growing number of threads and
+  // reports the visits per second of each, overall and per thread, to
+  // measure how search scales.
+  class Benchmark {
+  public:
+    void Run();
+  };
+
+} // namespace pzero
@@ -24,6 +24,7 @@ namespace pzero {
     
     NetworkFactory::PopulateOptions(options);
     options->Add<IntOption>(kThreadsOptionId, 1, 128) = kDefaultThreads;
+    LevelCollection::PopulateOptions(options);
 
     SearchParams::Populate(options);
   }
@@ -50,6 +51,26 @@ namespace pzero {
     network_ = NetworkFactory::LoadNetwork(options_);
   }
 
+  void EngineController::SetPosition(const std::string& fen,
+                                     const std::vector<std::string>& moves) {
+    current_position_ = CurrentPosition{fen, moves};
+  }
+
+  void EngineController::SetLevel(int level,
+                                  const std::vector<std::string>& moves) {
+    const auto filename = options_.Get<std::string>(
+      LevelCollection::kLevelsId.GetId());
+    if (filename.empty()) {
+      SetPosition(SokoBoard::kStartposFen, moves);
+      return;
+    }
+    if (!levels_ || filename != levels_filename_) {
+      levels_ = std::make_unique<LevelCollection>(filename);
+      levels_filename_ = filename;
+    }
+    SetPosition(levels_->GetFen(level - 1), moves);
+  }
+
   void EngineController::SetupPosition(const std::string& fen, const std::vector<std::string>& moves_str) {
     SharedLock lock(busy_mutex_);
 
@@ -99,7 +120,7 @@ namespace pzero {
 
   void EngineLoop::CmdPosition(const int level,
                                const std::vector<std::string>& moves) {
-
+    engine_.SetLevel(level, moves);
   }
 
   void EngineLoop::CmdGo(const GoParams& params) {
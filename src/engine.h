@@ -4,6 +4,7 @@
 #include "mcts/search.h"
 #include "neural/factory.h"
 #include "neural/network.h"
+#include "soko/levels.h"
 #include "utils/mutex.h"
 #include "utils/optional.h"
 #include "utils/optionsparser.h"
@@ -29,6 +30,10 @@ namespace pzero {
     void SetPosition(const std::string& fen,
                      const std::vector<std::string>& moves);
 
+    // Sets up the level with the given one based number from the --levels
+    // collection, or the start position when no collection is given.
+    void SetLevel(int level, const std::vector<std::string>& moves);
+
     void Go(const GoParams& params);
 
     SearchLimits PopulateSearchLimits(const GoParams& params,
@@ -51,6 +56,9 @@ namespace pzero {
     std::unique_ptr<NodeTree> tree_;
     std::unique_ptr<Network> network_;
 
+    std::string levels_filename_;
+    std::unique_ptr<LevelCollection> levels_;
+
 
     optional<CurrentPosition> current_position_;
     GoParams go_params_;
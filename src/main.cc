@@ -1,4 +1,6 @@
 #include "engine.h"
+#include "benchmark/benchmark.h"
+#include "perft/perft.h"
 #include "selfplay/loop.h"
 #include "utils/logging.h"
 #include "utils/commandline.h"
@@ -17,10 +19,18 @@ int main(int argc, const char** argv) {
   CommandLine::Init(argc, argv);
   CommandLine::RegisterMode("uci", "(default) Act as UCI engine");
   CommandLine::RegisterMode("selfplay", "Play a game with best moves");
+  CommandLine::RegisterMode("perft", "Count positions to measure move generation");
+  CommandLine::RegisterMode("benchmark", "Measure how search scales with threads");
   
   if (CommandLine::ConsumeCommand("selfplay")) {
     SelfPlayLoop loop;
     loop.RunLoop();
+  } else if (CommandLine::ConsumeCommand("perft")) {
+    PerftLoop perft;
+    perft.Run();
+  } else if (CommandLine::ConsumeCommand("benchmark")) {
+    Benchmark benchmark;
+    benchmark.Run();
   } else {
   CommandLine::ConsumeCommand("uci");
   EngineLoop loop;
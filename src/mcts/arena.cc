@@ -0,0 +1,93 @@
+#include "mcts/arena.h"
+
+#include <atomic>
+#include <cassert>
+#include "utils/exception.h"
+
+namespace pzero {
+
+  char* NodeArena::slab_table_[NodeArena::kMaxSlabs];
+
+  namespace {
+    // Slabs kept for reuse by later trees, beyond that they are freed.
+    const size_t kMaxPooledSlabs = 64;
+
+    // Slabs start on a cache line, so no unit straddles two lines.
+    constexpr size_t kSlabAlignment = 64;
+
+    std::atomic<std::uint64_t> gNextArenaId{1};
+
+    Mutex gPoolMutex;
+    // Slab numbers whose memory is kept for reuse.
+    std::vector<std::uint32_t> gSlabPool GUARDED_BY(gPoolMutex);
+    // Slab numbers whose memory was freed.
+    std::vector<std::uint32_t> gFreeSlabs GUARDED_BY(gPoolMutex);
+    // Number 0 is never used, so that no unit has index 0.
+    std::uint32_t gNextSlab GUARDED_BY(gPoolMutex) = 1;
+    // Memory as allocated of every slab, before its start was aligned.
+    char* gSlabMemory[NodeArena::kMaxSlabs] GUARDED_BY(gPoolMutex);
+
+    // The slab the thread allocates from. A thread going back and forth
+    // between arenas takes a new slab every time it switches.
+    struct ThreadSlab {
+      std::uint64_t arena_id = 0;
+      std::uint32_t next = 0;
+      std::uint32_t end = 0;
+    };
+    thread_local ThreadSlab tThreadSlab;
+  } // namespace
+
+  NodeArena::NodeArena() : id_(gNextArenaId++) {}
+
+  NodeArena::~NodeArena() {
+    Mutex::Lock pool_lock(gPoolMutex);
+    for (const auto slab : slabs_) {
+      if (gSlabPool.size() < kMaxPooledSlabs) {
+        gSlabPool.push_back(slab);
+      } else {
+        delete[] gSlabMemory[slab];
+        gSlabMemory[slab] = nullptr;
+        slab_table_[slab] = nullptr;
+        gFreeSlabs.push_back(slab);
+      }
+    }
+  }
+
+  std::uint32_t NodeArena::Allocate(std::uint32_t units) {
+    assert(units > 0 && units <= kUnitsPerSlab);
+
+    auto& cache = tThreadSlab;
+    if (cache.arena_id != id_ || cache.end - cache.next < units) {
+      std::uint32_t slab;
+      {
+        Mutex::Lock pool_lock(gPoolMutex);
+        if (!gSlabPool.empty()) {
+          slab = gSlabPool.back();
+          gSlabPool.pop_back();
+        } else {
+          if (!gFreeSlabs.empty()) {
+            slab = gFreeSlabs.back();
+            gFreeSlabs.pop_back();
+          } else if (gNextSlab < kMaxSlabs) {
+            slab = gNextSlab++;
+          } else {
+            throw Exception("Out of memory for search tree nodes");
+          }
+          char* memory = new char[kSlabSize + kSlabAlignment];
+          gSlabMemory[slab] = memory;
+          slab_table_[slab] = memory + kSlabAlignment -
+            reinterpret_cast<std::uintptr_t>(memory) % kSlabAlignment;
+        }
+      }
+      {
+        Mutex::Lock lock(mutex_);
+        slabs_.push_back(slab);
+      }
+      cache = {id_, slab << kUnitBits, (slab + 1) << kUnitBits};
+    }
+    const std::uint32_t result = cache.next;
+    cache.next += units;
+    return result;
+  }
+
+} // namespace pzero
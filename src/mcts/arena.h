@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "utils/mutex.h"
+
+namespace pzero {
+
+  // Storage for the nodes of one search tree, handed out in 32 byte units
+  // from large slabs. Allocations are named by 32 bit indices rather than
+  // pointers: the slab number in the high bits and the unit in the low
+  // ones, index 0 is never handed out and stands for none. Every thread
+  // bump-allocates from a slab of its own, so search threads don't contend
+  // on allocations. Nothing is freed on its own: destroying the arena
+  // returns all of its slabs to a shared pool at once, however many units
+  // they hold.
+  class NodeArena {
+  public:
+    NodeArena();
+    ~NodeArena();
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    static constexpr size_t kUnitSize = 32;
+    static constexpr size_t kSlabSize = 256 * 1024;
+    static constexpr int kUnitBits = 13;
+    static constexpr std::uint32_t kUnitsPerSlab = 1 << kUnitBits;
+    static constexpr std::uint32_t kMaxSlabs = 1 << 16;
+    static_assert(kUnitsPerSlab * kUnitSize == kSlabSize, "Slab size");
+
+    // Index of `units` consecutive units, which all lie in one slab so the
+    // unit after index `i` has index `i + 1`.
+    std::uint32_t Allocate(std::uint32_t units);
+
+    // Address of the unit with the given index.
+    static void* Resolve(std::uint32_t index) {
+      return slab_table_[index >> kUnitBits] +
+        (index & (kUnitsPerSlab - 1)) * kUnitSize;
+    }
+
+  private:
+    // Memory of every slab by its number, shared by all arenas.
+    static char* slab_table_[kMaxSlabs];
+
+    // Unique for the life of the process, tells thread caches which arena
+    // their slab belongs to.
+    const std::uint64_t id_;
+
+    Mutex mutex_;
+    std::vector<std::uint32_t> slabs_ GUARDED_BY(mutex_);
+  };
+
+} // namespace pzero
@@ -1,87 +1,14 @@
 #include "mcts/node.h"
 
+#include <algorithm>
 #include <cassert>
-#include <thread>
+#include <new>
 #include "neural/encoder.h"
 #include "neural/network.h"
 #include "utils/exception.h"
 
 namespace pzero {
 
-  namespace {
-    // Periodicity of garbage collection, milliseconds.
-    const int kGCIntervalMs = 100;
-
-    // Every kGCIntervalMs milliseconds release nodes in a separate GC thread.
-    class NodeGarbageCollector {
-    public:
-      NodeGarbageCollector() : gc_thread_([this]() { Worker(); }) {}
-
-      // Takes ownership of a subtree, to dispose it in a separate thread when
-      // it has time.
-      void AddToGcQueue(std::unique_ptr<Node> node) {
-        if (!node) return;
-        Mutex::Lock lock(gc_mutex_);
-        subtrees_to_gc_.emplace_back(std::move(node));
-      }
-
-      ~NodeGarbageCollector() {
-        // Flips stop flag and waits for a worker thread to stop.
-        stop_.store(true);
-        gc_thread_.join();
-      }
-
-    private:
-      void GarbageCollect() {
-        while (!stop_.load()) {
-          // Node will be released in destructor when mutex is not locked.
-          std::unique_ptr<Node> node_to_gc;
-          {
-            // Lock the mutex and move last subtree from subtrees_to_gc_ into
-            // node_to_gc.
-            Mutex::Lock lock(gc_mutex_);
-            if (subtrees_to_gc_.empty()) return;
-            node_to_gc = std::move(subtrees_to_gc_.back());
-            subtrees_to_gc_.pop_back();
-          }
-        }
-      }
-
-      void Worker() {
-        while (!stop_.load()) {
-          std::this_thread::sleep_for(std::chrono::milliseconds(kGCIntervalMs));
-          GarbageCollect();
-        };
-      }
-
-      mutable Mutex gc_mutex_;
-      std::vector<std::unique_ptr<Node>> subtrees_to_gc_ GUARDED_BY(gc_mutex_);
-
-      // When true, Worker() should stop and exit.
-      std::atomic<bool> stop_{false};
-      std::thread gc_thread_;
-    };  // namespace
-
-    NodeGarbageCollector gNodeGc;
-  }  // namespace
-
-  ////////
-  // Edge
-  ///////
-
-  Move Edge::GetMove() const {
-    return move_;
-  }
-
-  void Edge::SetP(float p) {
-    assert(0.0f <= p && p <= 1.0f);
-    p_ = p;
-  }
-
-  float Edge::GetP() const {
-    return p_;
-  }
-  
   ////////////
   // NodeTree
   ///////////
@@ -90,19 +17,47 @@ namespace pzero {
     Node* new_head = nullptr;
     for (auto& n : current_head_->Edges()) {
       if (n.GetMove() == move) {
-        new_head = n.GetOrSpawnNode(current_head_);
+        new_head = n.node();
         break;
       }
     }
-    current_head_ = new_head ? new_head : current_head_->CreateSingleChildNode(move);
+    if (!history_.Last().IsLegal(move)) {
+      throw Exception("Illegal move: " + move.as_string());
+    }
+    current_head_ = new_head ? new_head :
+      current_head_->CreateSingleChildNode(move, arena_.get());
     history_.Append(move);
   }
 
   void NodeTree::TrimTreeAtHead() {
-    auto tmp = std::move(current_head_->sibling_);
-    gNodeGc.AddToGcQueue(std::move(current_head_->child_));
-    *current_head_ = Node(current_head_->GetParent(), current_head_->index_);
-    current_head_->sibling_ = std::move(tmp);    
+    // Only the moves from the game begin to the head are needed any more.
+    // They are copied into a new arena, together with the moves and priors
+    // of their siblings, and the old one, with every search result in it,
+    // is dropped at once.
+    std::vector<Node*> path;
+    for (Node* node = current_head_; node; node = node->GetParent()) {
+      path.push_back(node);
+    }
+
+    auto arena = std::make_unique<NodeArena>();
+    Node* node = Node::NewRoot(arena.get());
+    gamebegin_node_ = node;
+    for (size_t i = path.size() - 1; i > 0; i--) {
+      const Node* old_node = path[i];
+      node->children_ = arena->Allocate(old_node->num_children_);
+      node->num_children_ = old_node->num_children_;
+      Node* next = nullptr;
+      for (const auto& old_child : old_node->Edges()) {
+        const auto offset = old_child.node() - Node::At(old_node->children_);
+        Node* child = new (Node::At(node->children_ + offset))
+          Node(node->children_ + offset, node->index_, old_child.GetMove());
+        child->p_ = old_child.node()->p_;
+        if (old_child.node() == path[i - 1]) next = child;
+      }
+      node = next;
+    }
+    current_head_ = node;
+    arena_ = std::move(arena);
   }
 
   bool NodeTree::ResetToPosition(const std::string& starting_fen,
@@ -113,14 +68,11 @@ namespace pzero {
 
     DeallocateTree();
 
-    if (!gamebegin_node_) {
-      gamebegin_node_ = std::make_unique<Node>(nullptr, 0);
-    }
+    gamebegin_node_ = Node::NewRoot(arena_.get());
 
     history_.Reset(starting_board);
 
-    Node* old_head = current_head_;
-    current_head_ = gamebegin_node_.get();
+    current_head_ = gamebegin_node_;
     for (const auto& move : moves) {
       MakeMove(move);
     }
@@ -130,50 +82,40 @@ namespace pzero {
 
 
   void NodeTree::DeallocateTree() {
-    gNodeGc.AddToGcQueue(std::move(gamebegin_node_));
-
+    arena_ = std::make_unique<NodeArena>();
     gamebegin_node_ = nullptr;
     current_head_ = nullptr;
   }
 
-  ////////////
-  // EdgeList
-  ///////////
-
-  EdgeList::EdgeList(MoveList moves)
-    : edges_(std::make_unique<Edge[]>(moves.size())), size_(moves.size()) {
-        auto* edge= edges_.get();
-        for (const auto move: moves) edge++->SetMove(move);
-  }
-
-
   ////////
   // Node
   ///////
 
-  Node* Node::CreateSingleChildNode(Move move) {
-    assert(!edges_);
-    assert(!child_);
-    edges_ = EdgeList({move});
-    child_ = std::make_unique<Node>(this, 0);
-    return child_.get();
+  Node* Node::NewRoot(NodeArena* arena) {
+    const auto index = arena->Allocate(1);
+    return new (At(index)) Node(index, 0, Move());
   }
 
-  void Node::CreateEdges(const MoveList& moves) {
-    assert(!edges_);
-    assert(!child_);
-    edges_ = EdgeList(moves);
+  Node* Node::CreateSingleChildNode(Move move, NodeArena* arena) {
+    assert(!children_);
+    CreateEdges({move}, arena);
+    return At(children_);
   }
 
-  Node::ConstIterator Node::Edges() const { return {edges_, &child_}; }
-  Node::Iterator Node::Edges() { return {edges_, &child_}; }
-
-  Edge* Node::GetEdgeToNode(const Node* node) const {
-    assert(node->parent_ == this);
-    assert(node->index_ < edges_.size());
-    return &edges_[node->index_];
+  void Node::CreateEdges(const MoveList& moves, NodeArena* arena) {
+    assert(!children_);
+    if (moves.empty()) return;
+    const auto first = arena->Allocate(moves.size());
+    for (size_t i = 0; i < moves.size(); i++) {
+      new (At(first + i)) Node(first + i, index_, moves[i]);
+    }
+    num_children_ = moves.size();
+    children_ = first;
   }
 
+  Node::ConstIterator Node::Edges() const {
+    return {children_ ? At(children_) : nullptr, num_children_};
+  }
 
   void Node::MakeTerminal(GameResult result) {
     is_terminal_ = true;
@@ -185,7 +127,14 @@ namespace pzero {
   }
 
   bool Node::TryStartScoreUpdate() {
-    if (n_ == 0 && n_in_flight_ > 0) return false;
+    auto extension = extension_.load(std::memory_order_acquire);
+    if (extension == kUnextended &&
+        extension_.compare_exchange_strong(extension, kExtending,
+                                           std::memory_order_acquire)) {
+      ++n_in_flight_;
+      return true;
+    }
+    if (extension == kExtending) return false;
     ++n_in_flight_;
     return true;
   }
@@ -195,48 +144,60 @@ namespace pzero {
   }
 
   void Node::FinalizeScoreUpdate(float v, int multivisit) {
-    q_ += multivisit * (v - q_) / (n_ + multivisit);
-
-    n_ += multivisit;
+    // Every update weighs its value by the visit count it took, so updates
+    // racing on the node still leave about the mean of all values.
+    const uint32_t n = n_.fetch_add(multivisit) + multivisit;
+    float q = q_.load();
+    while (!q_.compare_exchange_weak(q, q + multivisit * (v - q) / n)) {}
+
+    if (extension_.load(std::memory_order_relaxed) != kExtended) {
+      extension_.store(kExtended, std::memory_order_release);
+    }
     n_in_flight_ -= multivisit;
   }
   
-  V4TrainingData Node::GetV4TrainingData
+  V5TrainingData Node::GetV5TrainingData
   (GameResult game_result,
    const PositionHistory& history,
+   MoveMode move_mode,
    float best_q) const {
-    V4TrainingData result;
+    V5TrainingData result;
+    auto& header = result.header;
     
-    result.version = 4;
+    header.version = 5;
 
     const float total_n = static_cast<float>(GetChildrenVisits());
     if (total_n <= 0.0f) throw Exception("Search generated invalid data!");
 
-    std::fill(std::begin(result.probabilities), std::end(result.probabilities), -1);
-
+    // Targets sit at the index the search reads the prior of the move from.
+    const auto& board = history.Last();
+    header.num_probabilities = move_mode == MoveMode::Step ?
+      kNumStepPolicies : board.level().rows() * kMaxBoardSize * 4;
+    result.probabilities.assign(header.num_probabilities, -1);
     for (const auto& child : Edges()) {
-      result.probabilities[child.edge()->GetMove().as_nn_index()] =
+      result.probabilities[child.GetMove().as_nn_index()] =
         child.GetN() / total_n;
     }
 
+    header.rows = board.level().rows();
+    header.cols = board.level().cols();
+
     InputPlanes planes = EncodePositionForNN(history, 8);
-    int plane_idx = 0;
-    for (auto& plane : result.planes) {
-      plane = planes[plane_idx++].mask;
+    header.num_planes = planes.size();
+    for (const auto& plane : planes) {
+      result.planes.push_back(plane.mask);
     }
 
-    const auto& position = history.Last();
-
     if (game_result == GameResult::WIN) {
-      result.result = 1;
+      header.result = 1;
     } else if (game_result == GameResult::LOSE) {
-      result.result = -1;
+      header.result = -1;
     } else {
-      result.result = 0;
+      header.result = 0;
     }
 
-    result.root_q = -GetQ();
-    result.best_q = best_q;
+    header.root_q = -GetQ();
+    header.best_q = best_q;
     
     return result;
   }
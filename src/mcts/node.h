@@ -1,7 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <type_traits>
+#include "mcts/arena.h"
 #include "soko/board.h"
 #include "soko/position.h"
 #include "neural/encoder.h"
@@ -10,62 +18,81 @@
 
 namespace pzero {
   
-  class Node;
-  class Edge {
+  class EdgeAndNode;
+  class Edge_Iterator;
+
+  // A node of the search tree, together with the move leading to it and its
+  // prior. Children of a node are created all at once at expansion, as one
+  // array in the tree's arena, so that selection reads them from one or two
+  // cache lines. Nodes refer to each other by arena index.
+  //
+  // Search threads update nodes without locks. Visit counts and values are
+  // atomic, and the first visit of a node claims it for extension: the
+  // others collide with it until its value is backed up, and only then
+  // read its children.
+  class Node {
   public:
-    Move GetMove() const;
+    using Iterator = Edge_Iterator;
+    using ConstIterator = Edge_Iterator;
 
-    float GetP() const;
-    void SetP(float val);
-
-  private:
-    void SetMove(Move move) { move_ = move; }
+    Node(std::uint32_t index, std::uint32_t parent, Move move)
+      : index_(index), parent_(parent), move_(move) {}
 
-    Move move_;
-
-    uint16_t p_ = 0;
-    
-    friend class EdgeList;
-  };
-
-  class EdgeList {
-  public:
-    EdgeList() {}
-    EdgeList(MoveList moves);
-    Edge* get() const { return edges_.get(); }
-    Edge& operator[](size_t idx) const { return edges_[idx]; }
-    operator bool() const { return static_cast<bool>(edges_); }
-    uint16_t size() const { return size_; }
-
-  private:
-    std::unique_ptr<Edge[]> edges_;
-    uint16_t size_ = 0;
-  };
+    // Node with the given arena index.
+    static Node* At(std::uint32_t index) {
+      return static_cast<Node*>(NodeArena::Resolve(index));
+    }
 
-  class EdgeAndNode;
+    // Root of a new tree.
+    static Node* NewRoot(NodeArena* arena);
 
-  template <bool is_const>
-    class Edge_Iterator;
+    Node* CreateSingleChildNode(Move m, NodeArena* arena);
 
-  class Node {
-  public:
-    using Iterator = Edge_Iterator<false>;
-    using ConstIterator = Edge_Iterator<true>;
+    void CreateEdges(const MoveList& moves, NodeArena* arena);
 
-  Node(Node* parent, uint16_t index) 
-    : parent_(parent), index_(index) {}
+    Node* GetParent() const { return parent_ ? At(parent_) : nullptr; }
 
-    Node* CreateSingleChildNode(Move m);
+    bool HasChildren() const { return children_; }
 
-    void CreateEdges(const MoveList& moves);
+    // Whether the node was extended and its first value backed up. Until
+    // then only the thread extending it may read its children or terminal
+    // state.
+    bool IsExtended() const {
+      return extension_.load(std::memory_order_acquire) == kExtended;
+    }
 
-    Node* GetParent() const { return parent_; }
+    // Move which leads from the parent to this node.
+    Move GetMove() const { return move_; }
+
+    // The prior is kept in 16 bits: the float with its sign, top three
+    // exponent bits and low 12 mantissa bits dropped, which holds every
+    // value in [2^-31, 1] to a relative error of 2^-12. Smaller ones,
+    // 0 included, read back as 2^-31.
+    float GetP() const {
+      const std::uint32_t bits = (static_cast<std::uint32_t>(p_) << 12) |
+        (3u << 28);
+      float p;
+      std::memcpy(&p, &bits, sizeof(p));
+      return p;
+    }
 
-    bool HasChildren() const { return edges_; }
+    void SetP(float p) {
+      assert(0.0f <= p && p <= 1.0f);
+      // Adds half of the dropped mantissa to round to nearest, and takes
+      // the implied exponent bits away.
+      constexpr std::int32_t kRounding = (1 << 11) - (3 << 28);
+      std::int32_t bits;
+      std::memcpy(&bits, &p, sizeof(bits));
+      bits += kRounding;
+      p_ = bits < 0 ? 0 : static_cast<std::uint16_t>(bits >> 12);
+    }
 
     uint32_t GetN() const { return n_; }
     uint32_t GetNInFlight() const { return n_in_flight_; }
-    uint32_t GetChildrenVisits() const { return n_ > 0 ? n_ - 1 : 0; }
+    uint32_t GetChildrenVisits() const {
+      const uint32_t n = n_;
+      return n > 0 ? n - 1 : 0;
+    }
 
     int GetNStarted() const { return n_ + n_in_flight_; }
 
@@ -73,7 +100,7 @@ namespace pzero {
 
     bool IsTerminal() const { return is_terminal_; }
 
-    uint16_t GetNumEdges() const { return edges_.size(); }
+    uint16_t GetNumEdges() const { return num_children_; }
 
     void MakeTerminal(GameResult result);
 
@@ -85,157 +112,139 @@ namespace pzero {
 
     void IncrementNInFlight(int multivisit) { n_in_flight_ += multivisit; }
 
-    V4TrainingData GetV4TrainingData(GameResult result,
+    V5TrainingData GetV5TrainingData(GameResult result,
                                      const PositionHistory& history,
+                                     MoveMode move_mode,
                                      float best_q) const;
 
     ConstIterator Edges() const;
-    Iterator Edges();
-
-    Edge* GetEdgeToNode(const Node* node) const;
 
   private:
+    // Arena indices of the node itself, of its parent and of its first
+    // child, 0 when there is none.
+    std::uint32_t index_;
 
-    EdgeList edges_;
+    std::uint32_t parent_;
 
-    Node* parent_ = nullptr;
-    
-    std::unique_ptr<Node> child_;
-
-    std::unique_ptr<Node> sibling_;
+    std::uint32_t children_ = 0;
 
-    float q_ = 0.0f;
+    std::atomic<float> q_{0.0f};
 
-    uint32_t n_ = 0;
+    std::atomic<uint32_t> n_{0};
     
-    uint32_t n_in_flight_ = 0;
+    std::atomic<uint32_t> n_in_flight_{0};
 
-    uint16_t index_;
+    Move move_;
+
+    uint16_t p_ = 0;
+
+    uint16_t num_children_ = 0;
 
     bool is_terminal_ = false;
 
+    enum Extension : uint8_t { kUnextended, kExtending, kExtended };
+    std::atomic<uint8_t> extension_{kUnextended};
+
     friend class NodeTree;
-    friend class Edge_Iterator<true>;
-    friend class Edge_Iterator<false>;
-    friend class Edge;
   };
 
+  static_assert(sizeof(Node) == NodeArena::kUnitSize,
+                "Node must fill one arena unit");
+  static_assert(std::is_trivially_destructible<Node>::value,
+                "Arena nodes are never destroyed");
+
   class EdgeAndNode {
   public:
     EdgeAndNode() = default;
-  EdgeAndNode(Edge* edge, Node* node)
-    : edge_(edge), node_(node) {}
+    explicit EdgeAndNode(Node* node) : node_(node) {}
 
-    void Reset() { edge_ = nullptr; }
+    void Reset() { node_ = nullptr; }
 
     bool operator==(const EdgeAndNode& other) const {
-      return edge_ == other.edge_;
+      return node_ == other.node_;
     }
 
     bool operator!=(const EdgeAndNode& other) const {
-      return edge_ != other.edge_;
+      return node_ != other.node_;
     }
 
     bool operator<(const EdgeAndNode& other) const {
-      return edge_ < other.edge_;
+      return node_ < other.node_;
     }
 
-    Edge* edge() const { return edge_; }
     Node* node() const { return node_; }
 
 
     float GetQ(float default_q) const {
-      return (node_ && node_->GetN() > 0) ? node_->GetQ() : default_q;
+      return node_->GetN() > 0 ? node_->GetQ() : default_q;
+    }
+
+    // Q with every visit in flight counted as `virtual_loss` lost visits.
+    // An unvisited node counts as one visit worth `default_q`.
+    float GetQ(float default_q, float virtual_loss) const {
+      const uint32_t n = node_->GetN();
+      const float lost = virtual_loss * node_->GetNInFlight();
+      if (n == 0) return (default_q - lost) / (1 + lost);
+      return (n * node_->GetQ() - lost) / (n + lost);
     }
 
-    uint32_t GetN() const { return node_ ? node_->GetN() : 0; }
+    uint32_t GetN() const { return node_->GetN(); }
 
-    int GetNStarted() const { return node_ ? node_->GetNStarted() : 0; }
+    int GetNStarted() const { return node_->GetNStarted(); }
 
-    bool IsTerminal() const { return node_ ? node_->IsTerminal(): false; }
+    bool IsTerminal() const { return node_->IsTerminal(); }
 
 
-    float GetP() const { return edge_->GetP(); }
+    float GetP() const { return node_->GetP(); }
     Move GetMove() const {
-      return edge_ ? edge_->GetMove() : Move();
+      return node_ ? node_->GetMove() : Move();
     }
 
     float GetU(float numerator) const {
       return numerator * GetP() / (1 + GetNStarted());
     }
 
-  protected:
-    Edge* edge_ = nullptr;
+    // Number of further visits after which U has fallen enough for the
+    // score to reach `target_score`, assuming Q stays the same.
+    int GetVisitsToReachU(float target_score, float numerator, float q) const {
+      if (q >= target_score) return std::numeric_limits<int>::max();
+      const float n1 = GetNStarted() + 1;
+      return std::max(1.0f, std::min(std::floor(
+        GetP() * numerator / (target_score - q) - n1) + 1, 1e9f));
+    }
 
+  protected:
     Node* node_ = nullptr;
   };
 
-  template <bool is_const>
-    class Edge_Iterator : public EdgeAndNode {
+  // Walks the children of a node in order.
+  class Edge_Iterator : public EdgeAndNode {
   public:
-    using Ptr = std::conditional_t<is_const, const std::unique_ptr<Node>*,
-      std::unique_ptr<Node>*>;
-
     Edge_Iterator() {}
 
-    Edge_Iterator(const EdgeList& edges, Ptr node_ptr)
-      : EdgeAndNode(edges.size() ? edges.get() : nullptr, nullptr),
-      node_ptr_(node_ptr),
-      total_count_(edges.size()) {
-      if (edge_) Actualize();
-    }
+    Edge_Iterator(Node* first, uint16_t count)
+      : EdgeAndNode(count ? first : nullptr), left_(count) {}
 
-    Edge_Iterator<is_const> begin() { return *this; }
-    Edge_Iterator<is_const> end() { return {}; }
+    Edge_Iterator begin() { return *this; }
+    Edge_Iterator end() { return {}; }
 
     void operator++() {
-      if (++current_idx_ == total_count_) {
-        edge_ = nullptr;
+      if (--left_ == 0) {
+        node_ = nullptr;
       } else {
-        ++edge_;
-        Actualize();
+        ++node_;
       }
     }
 
     Edge_Iterator& operator*() { return *this; }
 
-    Node* GetOrSpawnNode(Node* parent) {
-      
-      if (node_) return node_;
-      Actualize();
-      if (node_) return node_;
-
-      std::unique_ptr<Node> tmp = std::move(*node_ptr_);
-
-      *node_ptr_ = std::make_unique<Node>(parent, current_idx_);
-
-      (*node_ptr_)->sibling_ = std::move(tmp);
-      Actualize();
-      return node_;      
-    }
-
   private:
-    void Actualize() {
-      while (*node_ptr_ && (*node_ptr_)->index_ < current_idx_) {
-        node_ptr_ = &(*node_ptr_)->sibling_;
-      }
-
-      if (*node_ptr_ && (*node_ptr_)->index_ == current_idx_) {
-        node_ = (*node_ptr_).get();
-        node_ptr_ = &node_->sibling_;
-      } else {
-        node_ = nullptr;
-      }
-    }
-
-    Ptr node_ptr_;
-    uint16_t current_idx_ = 0;
-    uint16_t total_count_ = 0;
+    uint16_t left_ = 0;
   };
 
   class NodeTree {
   public:
-    ~NodeTree() { DeallocateTree(); }
+    NodeTree() : arena_(std::make_unique<NodeArena>()) {}
 
     void MakeMove(Move move);
 
@@ -245,14 +254,17 @@ namespace pzero {
                          const std::vector<Move>& moves);
 
     Node* GetCurrentHead() const { return current_head_; }
-    Node* GetGameBeginNode() const { return gamebegin_node_.get(); }
+    Node* GetGameBeginNode() const { return gamebegin_node_; }
+    // Where searches of the tree allocate nodes, thread safe.
+    NodeArena* GetArena() const { return arena_.get(); }
     const PositionHistory& GetPositionHistory() const { return history_; }
 
   private:
     void DeallocateTree();
 
     Node* current_head_ = nullptr;
-    std::unique_ptr<Node> gamebegin_node_;
+    Node* gamebegin_node_ = nullptr;
+    std::unique_ptr<NodeArena> arena_;
     PositionHistory history_;
   };
   
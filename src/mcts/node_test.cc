@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include "src/mcts/node.h"
+
+namespace pzero {
+
+  TEST(Node, PriorRoundTrip) {
+    Node node(1, 0, Move());
+
+    const float smallest = std::ldexp(1.0f, -31);
+    node.SetP(0.0f);
+    EXPECT_EQ(node.GetP(), smallest);
+    node.SetP(1.0f);
+    EXPECT_EQ(node.GetP(), 1.0f);
+    node.SetP(0.5f);
+    EXPECT_EQ(node.GetP(), 0.5f);
+
+    // Every prior down to 2^-31 keeps 11 bits of mantissa.
+    for (float p = 1.0f; p > smallest; p *= 0.9993f) {
+      node.SetP(p);
+      EXPECT_LE(std::abs(node.GetP() - p), p * std::ldexp(1.0f, -12)) << p;
+    }
+
+    node.SetP(std::ldexp(1.0f, -40));
+    EXPECT_EQ(node.GetP(), smallest);
+  }
+
+  TEST(Node, VirtualLoss) {
+    Node node(1, 0, Move());
+    const EdgeAndNode edge(&node);
+
+    // Unvisited, the first play urgency is lowered by the visits in flight.
+    EXPECT_EQ(edge.GetQ(0.5f, 1.0f), 0.5f);
+    node.IncrementNInFlight(1);
+    EXPECT_FLOAT_EQ(edge.GetQ(0.5f, 1.0f), -0.25f);
+    EXPECT_FLOAT_EQ(edge.GetQ(0.5f, 3.0f), -0.625f);
+    EXPECT_EQ(edge.GetQ(0.5f, 0.0f), 0.5f);
+
+    // Visited, they count as lost visits next to the real ones.
+    node.FinalizeScoreUpdate(0.5f, 1);
+    node.IncrementNInFlight(1);
+    node.FinalizeScoreUpdate(1.0f, 1);
+    node.IncrementNInFlight(1);
+    EXPECT_FLOAT_EQ(edge.GetQ(0.0f, 0.0f), 0.75f);
+    EXPECT_FLOAT_EQ(edge.GetQ(0.0f, 1.0f), (1.5f - 1.0f) / 3.0f);
+    EXPECT_FLOAT_EQ(edge.GetQ(0.0f, 2.0f), (1.5f - 2.0f) / 4.0f);
+  }
+
+} // namespace pzero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
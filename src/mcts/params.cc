@@ -27,6 +27,29 @@ namespace pzero {
     "fpu-value", "FpuValue",
       "\"First Play Urgency\" value used to adjust unvisited node eval."};
 
+  const OptionId SearchParams::kMoveModeId{
+    "move-mode", "MoveMode",
+      "Whether moves are single player steps (step), whole box pushes "
+      "including the walk to the box (push), or pushes which also carry the "
+      "box through tunnels and into goal room slots (macro)."};
+
+  const OptionId SearchParams::kCorralPruningId{
+    "corral-pruning", "CorralPruning",
+      "Prove corral deadlocks with a small search over the boxes fencing "
+      "each unreachable area when a node is extended."};
+
+  const OptionId SearchParams::kVirtualLossId{
+    "virtual-loss", "VirtualLoss",
+      "Number of lost visits every visit in flight counts as while children "
+      "are selected, so that parallel picks spread over the tree."};
+
+  const OptionId SearchParams::kMaxCollisionEventsId{
+    "max-collision-events", "MaxCollisionEvents",
+      "Allowed node collision events, per batch."};
+
+  const OptionId SearchParams::kMaxCollisionVisitsId{
+    "max-collision-visits", "MaxCollisionVisits",
+      "Total allowed node collision visits, per batch."};
   
   void SearchParams::Populate(OptionsParser* options) {
 
@@ -37,16 +60,38 @@ namespace pzero {
     options->Add<FloatOption>(kTemperatureId, 0.0f, 100.0f) = 0.0f;
     
     options->Add<FloatOption>(kFpuValueId, -100.0f, 100.0f) = 1.2f;
+
+    PopulateMoveMode(options);
+    options->Add<BoolOption>(kCorralPruningId) = false;
+    options->Add<FloatOption>(kVirtualLossId, 0.0f, 100.0f) = 1.0f;
+    options->Add<IntOption>(kMaxCollisionEventsId, 1, 1024) = 32;
+    options->Add<IntOption>(kMaxCollisionVisitsId, 1, 1000000) = 9999;
     
   }
 
+  void SearchParams::PopulateMoveMode(OptionsParser* options) {
+    std::vector<std::string> move_modes = {"step", "push", "macro"};
+    options->Add<ChoiceOption>(kMoveModeId, move_modes) = "step";
+  }
+
+  MoveMode SearchParams::ParseMoveMode(const std::string& mode) {
+    if (mode == "push") return MoveMode::Push;
+    if (mode == "macro") return MoveMode::Macro;
+    return MoveMode::Step;
+  }
+
   SearchParams::SearchParams(const OptionsDict& options)
     : options_(options),
       kCpuct(options.Get<float>(kCpuctId.GetId())),
       kCpuctBase(options.Get<float>(kCpuctBaseId.GetId())),
       kCpuctFactor(options.Get<float>(kCpuctFactorId.GetId())),
       kFpuValue(options.Get<float>(kFpuValueId.GetId())),
-      kMiniBatchSize(options.Get<int>(kMiniBatchSizeId.GetId())) {
+      kMiniBatchSize(options.Get<int>(kMiniBatchSizeId.GetId())),
+      kMoveMode(ParseMoveMode(options.Get<std::string>(kMoveModeId.GetId()))),
+      kCorralPruning(options.Get<bool>(kCorralPruningId.GetId())),
+      kVirtualLoss(options.Get<float>(kVirtualLossId.GetId())),
+      kMaxCollisionEvents(options.Get<int>(kMaxCollisionEventsId.GetId())),
+      kMaxCollisionVisits(options.Get<int>(kMaxCollisionVisitsId.GetId())) {
     
   }
 
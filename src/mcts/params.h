@@ -1,5 +1,6 @@
 #pragma once
 
+#include "soko/board.h"
 #include "utils/optionsdict.h"
 #include "utils/optionsparser.h"
 
@@ -12,6 +13,11 @@ namespace pzero {
 
     static void Populate(OptionsParser* options);
 
+    // Adds --move-mode alone, for modes which generate moves without
+    // searching.
+    static void PopulateMoveMode(OptionsParser* options);
+    static MoveMode ParseMoveMode(const std::string& mode);
+
     int GetMiniBatchSize() const {
       return kMiniBatchSize;
     }
@@ -25,6 +31,14 @@ namespace pzero {
 
     float GetFpuValue() const { return kFpuValue; }
 
+    MoveMode GetMoveMode() const { return kMoveMode; }
+
+    bool GetCorralPruning() const { return kCorralPruning; }
+
+    float GetVirtualLoss() const { return kVirtualLoss; }
+    int GetMaxCollisionEvents() const { return kMaxCollisionEvents; }
+    int GetMaxCollisionVisits() const { return kMaxCollisionVisits; }
+
 
     static const OptionId kMiniBatchSizeId;
     static const OptionId kCpuctId;
@@ -32,6 +46,11 @@ namespace pzero {
     static const OptionId kCpuctFactorId;
     static const OptionId kTemperatureId;
     static const OptionId kFpuValueId;
+    static const OptionId kMoveModeId;
+    static const OptionId kCorralPruningId;
+    static const OptionId kVirtualLossId;
+    static const OptionId kMaxCollisionEventsId;
+    static const OptionId kMaxCollisionVisitsId;
     
   private:
     const OptionsDict& options_;
@@ -41,6 +60,11 @@ namespace pzero {
     const float kCpuctFactor;
     const float kFpuValue;
     const int kMiniBatchSize;
+    const MoveMode kMoveMode;
+    const bool kCorralPruning;
+    const float kVirtualLoss;
+    const int kMaxCollisionEvents;
+    const int kMaxCollisionVisits;
     
   };
   
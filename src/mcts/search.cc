@@ -1,6 +1,7 @@
 #include "mcts/search.h"
 
 #include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <thread>
 
@@ -13,12 +14,17 @@ namespace pzero {
                  const SearchLimits& limits,
                  const OptionsDict& options):
     root_node_(tree.GetCurrentHead()),
+    arena_(tree.GetArena()),
     played_history_(tree.GetPositionHistory()),
     network_(network),
     limits_(limits),
     start_time_(std::chrono::steady_clock::now()),
     best_move_callback_(best_move_callback),
-    params_(options) {}
+    params_(options) {
+    if (params_.GetCorralPruning()) {
+      corral_detector_ = std::make_unique<CorralDetector>();
+    }
+  }
 
   void Search::StartThreads(size_t how_many) {
     Mutex::Lock lock(threads_mutex_);
@@ -68,25 +74,24 @@ namespace pzero {
   } // namespace
 
   float Search::GetBestEval() const {
-    SharedMutex::SharedLock lock(nodes_mutex_);
     Mutex::Lock counters_lock(counters_mutex_);
     float parent_q = -root_node_->GetQ();
-    if (!root_node_->HasChildren()) return parent_q;
+    if (!root_node_->IsExtended() || !root_node_->HasChildren()) {
+      return parent_q;
+    }
     EdgeAndNode best_edge = GetBestChildNoTemperature(root_node_);
     return best_edge.GetQ(parent_q);
   }
 
   Move Search::GetBestMove() {
-    SharedMutex::Lock lock(nodes_mutex_);
     Mutex::Lock counters_lock(counters_mutex_);
     EnsureBestMoveKnown();
     return final_bestmove_.GetMove();
   }
 
-  void Search::EnsureBestMoveKnown() REQUIRES(nodes_mutex_)
-    REQUIRES(counters_mutex_) {
+  void Search::EnsureBestMoveKnown() REQUIRES(counters_mutex_) {
     if (bestmove_is_sent_) return;
-    if (!root_node_->HasChildren()) return;
+    if (!root_node_->IsExtended() || !root_node_->HasChildren()) return;
 
     final_bestmove_ = GetBestChildNoTemperature(root_node_);
   }
@@ -118,13 +123,13 @@ namespace pzero {
   }
 
   void Search::MaybeTriggerStop() {
-    SharedMutex::Lock nodes_lock(nodes_mutex_);
     Mutex::Lock lock(counters_mutex_);
 
     if (bestmove_is_sent_) return;
 
     if (!stop_.load(std::memory_order_acquire)) {
-      if (GetTimeToDeadline() <= 0) {
+      // There is no best move to send before the root is extended.
+      if (GetTimeToDeadline() <= 0 && root_node_->IsExtended()) {
         FireStopInternal();
       }
     }
@@ -143,11 +148,22 @@ namespace pzero {
       Mutex::Lock lock(counters_mutex_);
 
       if (bestmove_is_sent_) break;
+
+      // Sleeps until the deadline or a stop rather than taking a core from
+      // the workers. The deadline is polled again while the root is not
+      // extended yet.
+      const auto delay = std::min<int64_t>(
+        std::max<int64_t>(GetTimeToDeadline(), 1), 100);
+      watchdog_cv_.wait_for(lock.get_raw(), std::chrono::milliseconds(delay),
+                            [this]() {
+                              return stop_.load(std::memory_order_acquire);
+                            });
     }
   }
 
   void Search::FireStopInternal() {
     stop_.store(true, std::memory_order_release);
+    watchdog_cv_.notify_all();
   }
 
   void Search::Stop() {
@@ -207,16 +223,20 @@ namespace pzero {
 
   void SearchWorker::GatherMinibatch() {
     int minibatch_size = 0;
-    int collision_events_left = 10;
+    int collision_events_left = params_.GetMaxCollisionEvents();
+    int collisions_left = params_.GetMaxCollisionVisits();
 
     while (minibatch_size < params_.GetMiniBatchSize()) {
-      minibatch_.emplace_back(PickNodeToExtend());
+      minibatch_.emplace_back(PickNodeToExtend(
+        std::min(collisions_left, params_.GetMiniBatchSize() - minibatch_size)));
 
       auto& picked_node = minibatch_.back();
       auto* node = picked_node.node;
         
       if (picked_node.IsCollision()) {
         if (--collision_events_left <= 0) return;
+        if ((collisions_left -= picked_node.multivisit) <= 0) return;
+        if (search_->stop_.load(std::memory_order_acquire)) return;
         continue;
       }
 
@@ -234,11 +254,26 @@ namespace pzero {
     }
   }
 
-  SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend() {
-    Node* node = search_->root_node_;
-    Node::Iterator best_edge;
+  namespace {
+    void IncrementNInFlight(Node* node, Node* root, int amount) {
+      if (amount == 0) return;
+      while (true) {
+        node->IncrementNInFlight(amount);
+        if (node == root) break;
+        node = node->GetParent();
+      }
+    }
+  } // namespace
 
-    SharedMutex::Lock lock(search_->nodes_mutex_);
+  // A collision stands for as many picks of the same path as would be made
+  // before another child becomes the best at some node on it, at most
+  // `collision_limit`. They are all counted as in flight on the path at
+  // once instead of each being picked and dropped again.
+  SearchWorker::NodeToProcess SearchWorker::PickNodeToExtend(
+    int collision_limit) {
+    Node* node = search_->root_node_;
+    EdgeAndNode best_edge;
+    EdgeAndNode second_best_edge;
 
     bool is_root_node = true;
     uint16_t depth = 0;
@@ -247,16 +282,17 @@ namespace pzero {
     while (true) {
      
       if (!node_already_updated) {
-        node = best_edge.GetOrSpawnNode(node);
+        node = best_edge.node();
       }
       best_edge.Reset();
       depth++;
 
       if (!node->TryStartScoreUpdate()) {
         if (!is_root_node) {
-          // IncrementNInFlight(node->GetParent(), search_->root_node_)
+          IncrementNInFlight(node->GetParent(), search_->root_node_,
+                             collision_limit - 1);
         }
-        return NodeToProcess::Collision(node, depth);
+        return NodeToProcess::Collision(node, depth, collision_limit);
       }
 
       if (node->IsTerminal() || !node->HasChildren()) {
@@ -268,20 +304,33 @@ namespace pzero {
       const float cpuct = ComputeCpuct(params_, node->GetN());
       const float puct_mult =
         cpuct * std::sqrt(std::max(node->GetChildrenVisits(), 1u));
+      const float virtual_loss = params_.GetVirtualLoss();
       float best = std::numeric_limits<float>::lowest();
-      int possible_moves = 0;
+      float second_best = std::numeric_limits<float>::lowest();
+      float best_q = 0.0f;
       const float fpu = GetFpu(params_, node, is_root_node);
       for (auto child : node->Edges()) {
-        if (is_root_node) {
-          ++possible_moves;
-        }
-        const float Q = child.GetQ(fpu);
+        const float Q = child.GetQ(fpu, virtual_loss);
         const float score = child.GetU(puct_mult) + Q;
         if (score > best) {
+          second_best = best;
+          second_best_edge = best_edge;
           best = score;
+          best_q = Q;
           best_edge = child;
+        } else if (score > second_best) {
+          second_best = score;
+          second_best_edge = child;
         }
       }
+
+      if (second_best_edge.node()) {
+        collision_limit = std::min(
+          collision_limit,
+          best_edge.GetVisitsToReachU(second_best, puct_mult, best_q));
+        assert(collision_limit >= 1);
+        second_best_edge.Reset();
+      }
       is_root_node = false;
     }
   }
@@ -296,7 +345,7 @@ namespace pzero {
     Node* cur = node;
     while (cur != search_->root_node_) {
       Node* prev = cur->GetParent();
-      to_add.push_back(prev->GetEdgeToNode(cur)->GetMove());
+      to_add.push_back(cur->GetMove());
       cur = prev;
     }
 
@@ -304,25 +353,39 @@ namespace pzero {
       history_.Append(to_add[i]);
     }
 
-    const auto& board = history_.Last().GetBoard();
-    auto legal_moves = board.GenerateLegalMoves();
+    const auto& board = history_.Last();
+    auto legal_moves = board.GenerateLegalMoves(params_.GetMoveMode());
 
     if (board.IsEnd()) {
       node->MakeTerminal(GameResult::WIN);
       return;
     }
 
-    if (board.IsStuck()) {
+    if (board.IsStuck() || board.IsFreezeDeadlock() ||
+        board.IsPatternDeadlock() || board.LowerBound() < 0) {
+      node->MakeTerminal(GameResult::LOSE);
+      return;
+    }
+
+    if (search_->corral_detector_ &&
+        search_->corral_detector_->IsDeadlock(board)) {
       node->MakeTerminal(GameResult::LOSE);
       return;
     }
 
-    if (history_.Last().GetRepetitions() >= 1) {
+    if (history_.GetLastRepetitions() >= 1) {
       node->MakeTerminal(GameResult::LOSE);
       return;
     }
 
-    node->CreateEdges(legal_moves);
+    // With pushes as moves the player can be walled in without the boxes
+    // being stuck.
+    if (legal_moves.empty()) {
+      node->MakeTerminal(GameResult::LOSE);
+      return;
+    }
+
+    node->CreateEdges(legal_moves, search_->arena_);
   }
 
 
@@ -368,27 +431,25 @@ namespace pzero {
     for (auto edge : node->Edges()) {
       float p = 
         computation_->GetPVal(idx_in_computation, edge.GetMove().as_nn_index());
-      edge.edge()->SetP(p);
+      edge.node()->SetP(p);
 
-      total += edge.edge()->GetP();
+      total += edge.GetP();
     }
 
     if (total > 0.0f) {
       const float scale = 1.0f / total;
-      for (auto edge : node->Edges()) edge.edge()->SetP(edge.GetP() * scale);
+      for (auto edge : node->Edges()) edge.node()->SetP(edge.GetP() * scale);
     }
   }
 
   void SearchWorker::DoBackupUpdate() {
-    SharedMutex::Lock lock(search_->nodes_mutex_);
-
     for (const NodeToProcess& node_to_process : minibatch_) {
       DoBackupUpdateSingleNode(node_to_process);
     }
   }
 
   void SearchWorker::DoBackupUpdateSingleNode
-  (const NodeToProcess& node_to_process) REQUIRES(search_->nodes_mutex_) {
+  (const NodeToProcess& node_to_process) {
     Node* node = node_to_process.node;
 
     if (node_to_process.IsCollision()) {
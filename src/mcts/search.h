@@ -1,8 +1,9 @@
 #pragma once
 
-#include <shared_mutex>
+#include <condition_variable>
 #include <thread>
 #include "soko/callbacks.h"
+#include "soko/corral.h"
 #include "mcts/node.h"
 #include "mcts/params.h"
 #include "neural/network.h"
@@ -51,9 +52,10 @@ namespace pzero {
     
     void WatchdogThread();
 
-    mutable Mutex counters_mutex_ ACQUIRED_AFTER(nodes_mutex_);
+    mutable Mutex counters_mutex_;
 
     std::atomic<bool> stop_{false};
+    std::condition_variable watchdog_cv_;
 
     bool bestmove_is_sent_ GUARDED_BY(counters_mutex_) = false;
 
@@ -63,6 +65,7 @@ namespace pzero {
     std::vector<std::thread> threads_ GUARDED_BY(threads_mutex_);
 
     Node* root_node_;
+    NodeArena* const arena_;
 
     const PositionHistory& played_history_;
 
@@ -70,10 +73,11 @@ namespace pzero {
     const SearchLimits limits_;
     const std::chrono::steady_clock::time_point start_time_;
 
-    mutable SharedMutex nodes_mutex_;
-
     BestMoveInfo::Callback best_move_callback_;
     const SearchParams params_;
+
+    // Only built with corral pruning on.
+    std::unique_ptr<CorralDetector> corral_detector_;
     
     friend class SearchWorker;
   };
@@ -118,8 +122,9 @@ namespace pzero {
       bool nn_queried = false;
       bool is_collision = false;
 
-      static NodeToProcess Collision(Node* node, uint16_t depth) {
-        return NodeToProcess(node, depth, true, 1);
+      static NodeToProcess Collision(Node* node, uint16_t depth,
+                                     int collision_count) {
+        return NodeToProcess(node, depth, true, collision_count);
       }
 
       static NodeToProcess Visit(Node* node, uint16_t depth) {
@@ -134,7 +139,7 @@ namespace pzero {
           is_collision(is_collision) {}
     };
 
-    NodeToProcess PickNodeToExtend();
+    NodeToProcess PickNodeToExtend(int collision_limit);
     void ExtendNode(Node* node);
     void AddNodeToComputation(Node* node);
     void FetchSingleNodeResult(NodeToProcess* node_to_process,
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include "src/mcts/search.h"
+#include "src/neural/factory.h"
+
+namespace pzero {
+
+  // Searches the position for a little while, with pushes as moves.
+  void SearchPushes(NodeTree* tree, const std::string& fen) {
+    OptionsParser options;
+    NetworkFactory::PopulateOptions(&options);
+    SearchParams::Populate(&options);
+    options.GetMutableDefaultsOptions()->Set<std::string>(
+      SearchParams::kMoveModeId.GetId(), "push");
+    const auto& dict = options.GetOptionsDict();
+    const auto network = NetworkFactory::LoadNetwork(dict);
+
+    tree->ResetToPosition(fen, {});
+    SearchLimits limits;
+    limits.search_deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+    Search search(*tree, network.get(), [](const BestMoveInfo&) {}, limits,
+                  dict);
+    search.RunBlocking(1);
+  }
+
+  TEST(Search, PushDeadEnd) {
+    // Pushing the lower box up walls the player in for good: the box in the
+    // gap of the wall is held by the one above it.
+    NodeTree tree;
+    SearchPushes(&tree,
+                 "#######\n"
+                 "#.   .#\n"
+                 "#  $  #\n"
+                 "### ###\n"
+                 "#  $  #\n"
+                 "#  @  #\n"
+                 "#######\n");
+
+    const Node* root = tree.GetCurrentHead();
+    ASSERT_TRUE(root->IsExtended());
+    bool found = false;
+    for (const auto& child : root->Edges()) {
+      if (!(child.GetMove() == Move("up@2,3"))) continue;
+      found = true;
+      ASSERT_TRUE(child.node()->IsExtended());
+      EXPECT_TRUE(child.IsTerminal());
+      EXPECT_EQ(child.node()->GetQ(), -1.0f);
+    }
+    EXPECT_TRUE(found);
+  }
+
+  TEST(Search, RootWithoutPushes) {
+    NodeTree tree;
+    SearchPushes(&tree,
+                 "#######\n"
+                 "#.   .#\n"
+                 "#  $  #\n"
+                 "###$###\n"
+                 "#  @  #\n"
+                 "#######\n");
+
+    const Node* root = tree.GetCurrentHead();
+    EXPECT_TRUE(root->IsTerminal());
+    EXPECT_FALSE(root->HasChildren());
+    EXPECT_EQ(root->GetQ(), -1.0f);
+  }
+
+  TEST(Search, PushTrainingData) {
+    NodeTree tree;
+    SearchPushes(&tree,
+                 "#######\n"
+                 "#.   .#\n"
+                 "#  $  #\n"
+                 "#     #\n"
+                 "#  $  #\n"
+                 "#  @  #\n"
+                 "#######\n");
+    const Node* root = tree.GetCurrentHead();
+    const auto data = root->GetV5TrainingData
+      (GameResult::UNDECIDED, tree.GetPositionHistory(), MoveMode::Push, 0);
+
+    const std::string filename = testing::TempDir() + "push_training.gz";
+    {
+      TrainingDataWriter writer(filename);
+      writer.WriteChunk(data);
+      writer.Finalize();
+    }
+
+    gzFile fin = gzopen(filename.c_str(), "rb");
+    ASSERT_NE(fin, nullptr);
+    V5TrainingHeader header;
+    ASSERT_EQ(gzread(fin, &header, sizeof(header)), int(sizeof(header)));
+    ASSERT_EQ(header.num_probabilities, 7 * kMaxBoardSize * 4);
+    std::vector<float> probabilities(header.num_probabilities);
+    const int probabilities_size = probabilities.size() * sizeof(float);
+    ASSERT_EQ(gzread(fin, probabilities.data(), probabilities_size),
+              probabilities_size);
+    std::vector<uint64_t> planes(header.num_planes);
+    const int planes_size = planes.size() * sizeof(uint64_t);
+    ASSERT_EQ(gzread(fin, planes.data(), planes_size), planes_size);
+    EXPECT_EQ(planes, data.planes);
+    char extra;
+    EXPECT_EQ(gzread(fin, &extra, 1), 0);
+    gzclose(fin);
+    std::remove(filename.c_str());
+
+    // Every legal push has its share of the visits at the index the search
+    // reads its prior from, everything else is marked illegal.
+    const float total_n = root->GetChildrenVisits();
+    float total = 0;
+    int legal = 0;
+    for (const auto& child : root->Edges()) {
+      EXPECT_FLOAT_EQ(probabilities[child.GetMove().as_nn_index()],
+                      child.GetN() / total_n);
+      total += probabilities[child.GetMove().as_nn_index()];
+      ++legal;
+    }
+    EXPECT_FLOAT_EQ(total, 1.0f);
+    EXPECT_EQ(std::count(probabilities.begin(), probabilities.end(), -1.0f),
+              header.num_probabilities - legal);
+  }
+
+} // namespace pzero
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
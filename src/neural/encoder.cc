@@ -6,50 +6,78 @@ namespace pzero {
 
   namespace {
     const int kMoveHistory = 8;
-    const int kPlanesPerBoard = 32;
-    const int kAuxPlaneBase = kPlanesPerBoard * kMoveHistory;
+    // Levels are drawn on a canvas of at least this size, so that every
+    // level up to 20x20 is encoded in the same layout.
+    const int kMinCanvasSize = 20;
+
+    // Placement of a level on the input planes. The level's top row is the
+    // top row of the canvas, each plane holds one or two canvas rows.
+    struct Canvas {
+      explicit Canvas(const Level& level)
+        : rows(std::max(kMinCanvasSize, level.rows())),
+          cols(std::max(kMinCanvasSize, level.cols())),
+          row_offset(rows - level.rows()),
+          rows_per_plane(cols <= 32 ? 2 : 1),
+          planes((rows + rows_per_plane - 1) / rows_per_plane) {}
+
+      // Canvas rows of planes [plane, plane + rows_per_plane).
+      std::uint64_t Mask(const BitBoard& board, int plane) const {
+        std::uint64_t mask = 0;
+        for (int i = 0; i < rows_per_plane; ++i) {
+          const int row = plane * rows_per_plane + i - row_offset;
+          if (row < 0 || row >= kMaxBoardSize) continue;
+          mask |= board.word(row) << (i * cols);
+        }
+        return mask;
+      }
+
+      int Index(BoardSquare square) const {
+        return (square.row() + row_offset) * cols + square.col();
+      }
+
+      const int rows;
+      const int cols;
+      const int row_offset;
+      const int rows_per_plane;
+      // Planes per bitboard.
+      const int planes;
+    };
   } // namespace
 
   InputPlanes EncodePositionForNN(const PositionHistory& history,
                                   int history_planes) {
-    InputPlanes result(kAuxPlaneBase + 1);
+    const Canvas canvas(history.Last().level());
+    const int planes_per_board = 3 * canvas.planes + 2;
+    const int aux_plane_base = planes_per_board * kMoveHistory;
+
+    InputPlanes result(aux_plane_base + 2);
 
     {
-      const SokoBoard& board = history.Last().GetBoard();
-      result[kAuxPlaneBase + 0].SetAll();
+      const SokoBoard& board = history.Last();
+      result[aux_plane_base + 0].SetAll();
+      result[aux_plane_base + 1].Fill(board.BoxesOffTarget());
     }
 
+    // Earlier boards are rebuilt by taking moves back from the last one.
+    SokoBoard board = history.Last();
+    board.DropLowerBound();
     int history_idx = history.GetLength() - 1;
     for (int i = 0; i < std::min(history_planes, kMoveHistory);
          ++i, --history_idx) {
-      
-      const Position& position = 
-        history.GetPositionAt(history_idx < 0 ? 0 : history_idx);
-
-      const SokoBoard& board = position.GetBoard();
-
       if (history_idx < 0) break;
+      if (i > 0) history.UndoMoveAt(history_idx + 1, &board);
 
-      const int base = i * kPlanesPerBoard;
-
-      std::uint64_t walls[10];
-      std::uint64_t targets[10];
-      std::uint64_t boxes[10];
-
-
-      board.walls().as_int_array(walls);
-      board.targets().as_int_array(targets);
-      board.boxes().as_int_array(boxes);
+      const int base = i * planes_per_board;
 
-      for (int i = 0; i < 10; i++) {
-        result[base + 0 * 10 + i].mask = walls[i];
-        result[base + 1 * 10 + i].mask = targets[i];
-        result[base + 2 * 10 + i].mask = boxes[i];
+      for (int j = 0; j < canvas.planes; j++) {
+        result[base + 0 * canvas.planes + j].mask = canvas.Mask(board.walls(), j);
+        result[base + 1 * canvas.planes + j].mask = canvas.Mask(board.targets(), j);
+        result[base + 2 * canvas.planes + j].mask = canvas.Mask(board.boxes(), j);
       }
-      result[base + 3 * 10].mask = board.king().as_int();
+      result[base + 3 * canvas.planes].mask = canvas.Index(board.king());
 
-      const int repetitions = position.GetRepetitions();
-      if (repetitions >= 1) result[base + 3 * 10 + 1].SetAll();
+      const int repetitions = history.GetRepetitionsAt(history_idx);
+      if (repetitions >= 1) result[base + 3 * canvas.planes + 1].SetAll();
 
     }
     
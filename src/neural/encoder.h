@@ -5,6 +5,9 @@
 
 namespace pzero {
   
+  // Levels up to 20x20 are encoded as 32 planes per history board. Larger
+  // levels grow the canvas and with it the number of planes, see
+  // encoder.cc.
   InputPlanes EncodePositionForNN(const PositionHistory& history,
                                   int history_planes);
 
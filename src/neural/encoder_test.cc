@@ -83,9 +83,36 @@ namespace pzero {
     InputPlane king_plane = encoded_planes[3 * 10];
     
     EXPECT_EQ(king_plane.mask, (20 * 11 + 11));
+
+    InputPlane off_target_plane = encoded_planes[8 * 32 + 1];
+    EXPECT_EQ(off_target_plane.mask, ~0ull);
+    EXPECT_EQ(off_target_plane.value, 6.0f);
     
   }
   
+  TEST(EncodePositionForNN, EncodeLargeLevel) {
+    // 40 rows of 30 columns don't fit the 20x20 canvas. Planes still hold two
+    // rows each, so there are 20 planes per bitboard.
+    std::string fen(30, '#');
+    fen += "\n#@$.";
+    fen += std::string(25, ' ') + "#\n";
+    for (int i = 0; i < 38; i++) fen += std::string(30, '#') + "\n";
+
+    SokoBoard board(fen);
+    PositionHistory history;
+    history.Reset(board);
+
+    InputPlanes encoded_planes = EncodePositionForNN(history, 8);
+    const int planes_per_board = 3 * 20 + 2;
+    EXPECT_EQ(encoded_planes.size(), 8u * planes_per_board + 2);
+
+    // The top two rows go into the last plane of every bitboard, the second
+    // row from the top in its lower bits.
+    EXPECT_EQ(encoded_planes[2 * 20 + 19].mask, 1ull << 2);
+    EXPECT_EQ(encoded_planes[1 * 20 + 19].mask, 1ull << 3);
+    EXPECT_EQ(encoded_planes[3 * 20].mask, 38 * 30 + 1);
+  }
+
 } // namespace pzero
 
 int main(int argc, char** argv) {
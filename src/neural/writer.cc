@@ -24,10 +24,24 @@ namespace pzero {
     if (!fout_) throw Exception("Cannot create gzip file " + filename_);    
   }
 
-  void TrainingDataWriter::WriteChunk(const V4TrainingData& data) {
-    auto bytes_written =
-      gzwrite(fout_, reinterpret_cast<const char*>(&data), sizeof(data));
-    if (bytes_written != sizeof(data)) {
+  TrainingDataWriter::TrainingDataWriter(const std::string& filename)
+    : filename_(filename) {
+    fout_ = gzopen(filename_.c_str(), "wb");
+
+    if (!fout_) throw Exception("Cannot create gzip file " + filename_);
+  }
+
+  void TrainingDataWriter::WriteChunk(const V5TrainingData& data) {
+    const int header_size = sizeof(data.header);
+    const int probabilities_size =
+      data.probabilities.size() * sizeof(data.probabilities[0]);
+    const int planes_size = data.planes.size() * sizeof(data.planes[0]);
+    if (gzwrite(fout_, reinterpret_cast<const char*>(&data.header),
+                header_size) != header_size ||
+        gzwrite(fout_, reinterpret_cast<const char*>(data.probabilities.data()),
+                probabilities_size) != probabilities_size ||
+        gzwrite(fout_, reinterpret_cast<const char*>(data.planes.data()),
+                planes_size) != planes_size) {
       throw Exception("Unable to write into " + filename_);
     }
   }
@@ -1,5 +1,6 @@
 #include <zlib.h>
 #include <fstream>
+#include <vector>
 #include "utils/cppattributes.h"
 
 #pragma once
@@ -8,10 +9,16 @@ namespace pzero {
   
 #pragma pack(push, 1)
 
-  struct V4TrainingData {
+  struct V5TrainingHeader {
     uint32_t version;
-    float probabilities[4];
-    uint64_t planes[256];
+    // Number of policy targets, kNumStepPolicies when the moves are steps.
+    // With pushes as moves there is one per square of the level's rows and
+    // direction, at the index Move::as_nn_index() gives the push.
+    uint16_t num_probabilities;
+    // Level size, which decides the number and layout of the planes.
+    uint8_t rows;
+    uint8_t cols;
+    uint16_t num_planes;
     int8_t result;
     float root_q;
     float best_q;
@@ -19,15 +26,25 @@ namespace pzero {
   
 #pragma pack(pop)
 
+  // Written as the header followed by `num_probabilities` policy targets,
+  // -1 for illegal moves, and `num_planes` plane masks.
+  struct V5TrainingData {
+    V5TrainingHeader header;
+    std::vector<float> probabilities;
+    std::vector<uint64_t> planes;
+  };
+
   class TrainingDataWriter {
   public:
     TrainingDataWriter(int game_id);
 
+    TrainingDataWriter(const std::string& filename);
+
     TrainingDataWriter() {
       if (fout_) Finalize();
     }
 
-    void WriteChunk(const V4TrainingData& data);
+    void WriteChunk(const V5TrainingData& data);
 
     void Finalize();
 
@@ -0,0 +1,112 @@
+#include "perft/perft.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "mcts/params.h"
+#include "soko/levels.h"
+#include "utils/exception.h"
+#include "utils/optionsparser.h"
+
+namespace pzero {
+
+  namespace {
+
+    const OptionId kDepthId{"depth", "Depth", "Number of moves to look ahead."};
+
+    const OptionId kThreadsId{"threads", "Threads",
+      "Number of threads the root moves are split between.", 't'};
+
+    const OptionId kPruneDeadlocksId{"prune-deadlocks", "PruneDeadlocks",
+      "Leave out positions the search would find lost by deadlock checks."};
+
+    bool IsDeadlock(const SokoBoard& board) {
+      return board.IsStuck() || board.IsFreezeDeadlock() ||
+        board.IsPatternDeadlock() || board.LowerBound() < 0;
+    }
+
+  } // namespace
+
+  std::uint64_t Perft(SokoBoard* board, int depth, MoveMode mode,
+                      bool prune_deadlocks) {
+    if (depth == 0) return 1;
+
+    const auto moves = board->GenerateLegalMoves(mode);
+    if (depth == 1 && !prune_deadlocks) return moves.size();
+
+    std::uint64_t nodes = 0;
+    for (const auto move : moves) {
+      const auto undo = board->DoMove(move);
+      if (!prune_deadlocks || !IsDeadlock(*board)) {
+        nodes += Perft(board, depth - 1, mode, prune_deadlocks);
+      }
+      board->UndoMove(move, undo);
+    }
+    return nodes;
+  }
+
+  void PerftLoop::Run() {
+    OptionsParser options;
+    LevelCollection::PopulateLevelOptions(&options);
+    options.Add<IntOption>(kDepthId, 0, 100) = 4;
+    options.Add<IntOption>(kThreadsId, 1, 128) = 1;
+    SearchParams::PopulateMoveMode(&options);
+    options.Add<BoolOption>(kPruneDeadlocksId) = false;
+
+    if (!options.ProcessAllFlags()) return;
+
+    try {
+      const auto option_dict = options.GetOptionsDict();
+
+      const SokoBoard board(LevelCollection::GetFen(option_dict));
+
+      const int depth = option_dict.Get<int>(kDepthId.GetId());
+      const int threads = option_dict.Get<int>(kThreadsId.GetId());
+      const MoveMode mode = SearchParams::ParseMoveMode(
+        option_dict.Get<std::string>(SearchParams::kMoveModeId.GetId()));
+      const bool prune = option_dict.Get<bool>(kPruneDeadlocksId.GetId());
+
+      const auto start = std::chrono::steady_clock::now();
+
+      // Root moves are handed out to the threads one at a time.
+      const auto root_moves = board.GenerateLegalMoves(mode);
+      std::vector<std::uint64_t> counts(root_moves.size());
+      std::atomic<size_t> next{0};
+      std::vector<std::thread> workers;
+      for (int i = 0; i < threads; i++) {
+        workers.emplace_back([&]() {
+          SokoBoard copy = board;
+          for (size_t j = next++; j < counts.size(); j = next++) {
+            const Move move = root_moves[j];
+            const auto undo = copy.DoMove(move);
+            if (depth > 0 && (!prune || !IsDeadlock(copy))) {
+              counts[j] = Perft(&copy, depth - 1, mode, prune);
+            }
+            copy.UndoMove(move, undo);
+          }
+        });
+      }
+      for (auto& worker : workers) worker.join();
+
+      const auto elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+      std::uint64_t total = depth == 0 ? 1 : 0;
+      for (size_t j = 0; j < counts.size(); j++) {
+        std::cout << root_moves[j].as_string() << ": "
+                  << counts[j] << std::endl;
+        total += counts[j];
+      }
+      std::cout << "nodes " << total << " time "
+                << static_cast<int>(elapsed * 1000) << "ms nps "
+                << static_cast<std::uint64_t>(total / std::max(elapsed, 1e-6))
+                << std::endl;
+    } catch (Exception& ex) {
+      std::cerr << ex.what() << std::endl;
+    }
+  }
+
+} // namespace pzero
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include "soko/board.h"
+
+namespace pzero {
+
+  // Number of positions `depth` moves away from the board. With
+  // `prune_deadlocks` positions found lost by the deadlock checks search
+  // applies are neither counted nor expanded. The board is restored
+  // before returning.
+  std::uint64_t Perft(SokoBoard* board, int depth, MoveMode mode,
+                      bool prune_deadlocks);
+
+  // Counts the leaf positions of a level to a fixed depth, splitting the
+  // root moves between threads, and reports the move generation speed.
+  class PerftLoop {
+  public:
+    void Run();
+  };
+
+} // namespace pzero
@@ -4,16 +4,24 @@
 namespace pzero {
   
   SelfPlayGame::SelfPlayGame(PlayerOptions player)
-    : options_(player) {
+    : options_(player),
+      move_mode_(SearchParams::ParseMoveMode(
+        options_.uci_options->Get<std::string>(
+          SearchParams::kMoveModeId.GetId()))) {
     tree_ = std::make_shared<NodeTree>();
-    tree_->ResetToPosition(SokoBoard::kStartposFen, {});
+    tree_->ResetToPosition(options_.fen, {});
+    if (options_.uci_options->Get<bool>(
+          SearchParams::kCorralPruningId.GetId())) {
+      corral_detector_ = std::make_unique<CorralDetector>();
+    }
   }
 
   void SelfPlayGame::Play(int threads, bool training) {
     while (!abort_) {
-      game_result_ = tree_->GetPositionHistory().ComputeGameResult();
+      game_result_ = tree_->GetPositionHistory().ComputeGameResult(
+        move_mode_, corral_detector_.get());
 
-      CERR << tree_->GetPositionHistory().Last().GetBoard().DebugString();
+      CERR << tree_->GetPositionHistory().Last().DebugString();
 
       if (game_result_ != GameResult::UNDECIDED) break;
       
@@ -42,9 +50,10 @@ namespace pzero {
       if (training) {
         auto best_q = best_eval;
         training_data_.push_back
-          (tree_->GetCurrentHead()->GetV4TrainingData
+          (tree_->GetCurrentHead()->GetV5TrainingData
            (GameResult::UNDECIDED,
             tree_->GetPositionHistory(),
+            move_mode_,
             best_q));
       }
 
@@ -68,10 +77,20 @@ namespace pzero {
     for (Node* node = tree_->GetCurrentHead();
          node != tree_->GetGameBeginNode();
          node = node->GetParent()) {
-      moves.push_back(node->GetParent()->GetEdgeToNode(node)->GetMove());
+      moves.push_back(node->GetMove());
     }
     std::reverse(moves.begin(), moves.end());
-    return moves;
+
+    // Push moves are expanded into the player steps they stand for.
+    std::vector<Move> steps;
+    const auto& history = tree_->GetPositionHistory();
+    SokoBoard board = history.GetBoardAt(0);
+    for (const auto move : moves) {
+      const auto expanded = board.ExpandMove(move);
+      steps.insert(steps.end(), expanded.begin(), expanded.end());
+      board.DoMove(move);
+    }
+    return steps;
   }
 
   void SelfPlayGame::Abort() {
@@ -86,11 +105,11 @@ namespace pzero {
 
     for (auto chunk : training_data_) {
       if (game_result_ == GameResult::WIN) {
-        chunk.result = 1;
+        chunk.header.result = 1;
       } else if (game_result_ == GameResult::LOSE) {
-        chunk.result = -1;
+        chunk.header.result = -1;
       } else {
-        chunk.result = 0;
+        chunk.header.result = 0;
       }
       writer->WriteChunk(chunk);
     }
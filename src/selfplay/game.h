@@ -19,6 +19,9 @@ namespace pzero {
 
     const OptionsDict* uci_options;
 
+    // Level the game starts from.
+    std::string fen = SokoBoard::kStartposFen;
+
     SelfPlayLimits search_limits;    
   };
 
@@ -39,17 +42,23 @@ namespace pzero {
 
     PlayerOptions options_;
 
+    const MoveMode move_mode_;
+
     std::shared_ptr<NodeTree> tree_;
 
     std::unique_ptr<Search> search_;
 
+    // Judges the game like search judges its nodes, when it prunes corral
+    // deadlocks.
+    std::unique_ptr<CorralDetector> corral_detector_;
+
     bool abort_ = false;
 
     GameResult game_result_ = GameResult::UNDECIDED;
 
     std::mutex mutex_;
     
-    std::vector<V4TrainingData> training_data_;
+    std::vector<V5TrainingData> training_data_;
   };
   
 } // namespace pzero
@@ -29,6 +29,7 @@ namespace pzero {
     options->Add<IntOption>(kParallelGamesId, 1, 256) = 8;
     options->Add<IntOption>(kTimeMsId, -1, 9999999) = -1;
     options->Add<BoolOption>(kTrainingId) = false;
+    LevelCollection::PopulateOptions(options);
   }
 
   SelfPlayTournament::SelfPlayTournament
@@ -53,6 +54,10 @@ namespace pzero {
     if (search_limits_.movetime == -1) {
       throw Exception("Please define --movetime, otherwise it's not clear when to stop search.");
     }
+
+    const auto levels = options.Get<std::string>(
+      LevelCollection::kLevelsId.GetId());
+    if (!levels.empty()) levels_ = std::make_unique<LevelCollection>(levels);
   }
 
   void SelfPlayTournament::PlayOneGame(int game_number) {
@@ -62,6 +67,7 @@ namespace pzero {
     options.network = network_.get();
     options.uci_options = &player_options_;
     options.search_limits = search_limits_;
+    if (levels_) options.fen = levels_->GetFen(game_number % levels_->size());
 
     options.best_move_callback = [this, game_number](const BestMoveInfo& info) {
                                BestMoveInfo rich_info = info;
@@ -2,6 +2,7 @@
 
 #include <list>
 #include "selfplay/game.h"
+#include "soko/levels.h"
 #include "utils/mutex.h"
 #include "utils/optionsdict.h"
 #include "utils/optionsparser.h"
@@ -48,6 +49,9 @@ namespace pzero {
 
     std::shared_ptr<Network> network_;
 
+    // Levels to play in turn, null to always play the start position.
+    std::unique_ptr<LevelCollection> levels_;
+
     const OptionsDict player_options_;
     SelfPlayLimits search_limits_;
 
@@ -3,13 +3,17 @@
 
 namespace pzero {
 
+  constexpr std::uint16_t Move::kDirectionMask;
+  constexpr std::uint16_t Move::kPushFlag;
+  constexpr int Move::kSquareShift;
+
   namespace {
     const Move kIdxToMove[] = {
       "up", "down", "left", "right"
     };
 
     std::vector<unsigned short> BuildMoveIndices() {
-      std::vector<unsigned short> res(4);
+      std::vector<unsigned short> res(kNumStepPolicies);
       for (size_t i = 0; i < 4; ++i) {
         res[kIdxToMove[i].as_packed_int()] = i;
       }
@@ -37,13 +41,33 @@ namespace pzero {
     default:
       throw Exception("Bad move: " + str);
     }
+
+    // Pushes are written as "<direction>@<row>,<col>" of the pushed box,
+    // with a trailing '+' for macro pushes.
+    const auto at = str.find('@');
+    if (at == std::string::npos) return;
+    const auto comma = str.find(',', at);
+    if (comma == std::string::npos) throw Exception("Bad move: " + str);
+    try {
+      const int row = std::stoi(str.substr(at + 1, comma - at - 1));
+      const int col = std::stoi(str.substr(comma + 1));
+      if (row < 0 || row >= kMaxBoardSize || col < 0 || col >= kMaxBoardSize) {
+        throw Exception("Bad move: " + str);
+      }
+      *this = Move(BoardSquare(row, col), direction(), str.back() == '+');
+    } catch (std::logic_error&) {
+      throw Exception("Bad move: " + str);
+    }
   }
 
-  uint8_t Move::as_packed_int() const {
-    return static_cast<int>(direction());
+  uint16_t Move::as_packed_int() const {
+    return data_;
   }
 
-  uint8_t Move::as_nn_index() const {
+  uint16_t Move::as_nn_index() const {
+    if (is_push()) {
+      return box().as_int() * 4 + static_cast<int>(direction());
+    }
     return kMoveToIdx[as_packed_int()];
   }
 
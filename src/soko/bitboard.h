@@ -1,26 +1,36 @@
 #pragma once
 
-#include <bitset>
 #include <cassert>
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace pzero {
 
+  // Levels have up to 64 rows and columns, row 0 is the bottom row. Squares
+  // are numbered with a fixed stride of one 64-bit word per row, so square
+  // indices don't depend on the level size.
+  constexpr int kMaxBoardSize = 64;
+  constexpr int kNumSquares = kMaxBoardSize * kMaxBoardSize;
+
   class BoardSquare {
   public:
     constexpr BoardSquare() {}
 
     constexpr BoardSquare(std::uint16_t num) : square_(num) {}
-    
-    constexpr BoardSquare(int row, int col) : BoardSquare(row * 20 + col) {}
+
+    constexpr BoardSquare(int row, int col)
+      : BoardSquare(row * kMaxBoardSize + col) {}
 
     constexpr std::uint16_t as_int() const { return square_; }
 
-    void set(int row, int col) { square_ = row * 20 + col; }
+    void set(int row, int col) { square_ = row * kMaxBoardSize + col; }
 
-    int row() const { return square_ / 20; }
-    int col() const { return square_ % 20; }
+    int row() const { return square_ / kMaxBoardSize; }
+    int col() const { return square_ % kMaxBoardSize; }
 
     constexpr bool operator==(const BoardSquare& other) const {
       return square_ == other.square_;
@@ -30,54 +40,6 @@ namespace pzero {
     std::uint16_t square_ = 0;
   };
 
-  class BitBoard {
-  public:
-    BitBoard() = default;
-    BitBoard(const BitBoard&) = default;
-
-    void as_int_array(std::uint64_t arr[]) const {
-      
-      for (int i = 0; i < 10; i++) {
-        uint64_t value = 0;
-        for (int j = 0; j < 40; j++) {
-          if (get(i * 40 + j))
-            value |=  1ull << j;
-        }
-        arr[i] = value;
-      }
-    }
-
-    void clear() { board_ = 0; }
-
-    void set(BoardSquare square) { set(square.as_int()); }
-    void set(std::uint16_t pos) { board_.set(pos); }
-    void set(int row, int col) { set(BoardSquare(row, col)); }
-    
-    void reset(BoardSquare square) { reset(square.as_int()); }
-    void reset(std::uint16_t pos) { board_.reset(pos); }
-    void reset(int row, int col) { reset(BoardSquare(row, col)); }
-
-    bool get(BoardSquare square) const { return get(square.as_int()); }
-    bool get(std::uint16_t pos) const {
-      return board_.test(pos);
-    }
-    bool get(int row, int col) const { return get(BoardSquare(row, col)); }
-
-    bool empty() const { return board_.count() == 0; }
-
-    bool intersects(const BitBoard& other) const { return board_.to_string() == other.board_.to_string(); }
-
-    bool operator==(const BitBoard& other) const {
-      return board_.to_string() == other.board_.to_string();
-    }
-    bool operator!=(const BitBoard& other) const {
-      return board_.to_string() != other.board_.to_string();
-    }
-
-  private:
-    std::bitset<400> board_;
-  };
-  
   class Move {
   public:
     enum class Direction : std::uint8_t { Up, Down, Left, Right };
@@ -88,40 +50,387 @@ namespace pzero {
     Move(const Move::Direction dir) {
       SetDirection(dir);
     };
+    // Push of the box standing on `box`. The player first walks to the
+    // square behind the box, so a push stands for a whole step sequence.
+    // Macro pushes go on with the pushes the level forces afterwards, see
+    // SokoBoard::GenerateLegalMacroPushes.
+    Move(BoardSquare box, Move::Direction dir, bool macro = false)
+      : data_(kPushFlag | (box.as_int() << kSquareShift) |
+              (macro ? kMacroFlag : 0)) {
+      SetDirection(dir);
+    }
 
-    Direction direction() const { return Direction(data_); }
+    Direction direction() const { return Direction(data_ & kDirectionMask); }
 
     void SetDirection(Direction dir) {
-      data_ = static_cast<uint8_t>(dir);
+      data_ = (data_ & ~kDirectionMask) | static_cast<uint16_t>(dir);
+    }
+
+    bool is_push() const { return data_ & kPushFlag; }
+
+    bool is_macro() const { return data_ & kMacroFlag; }
+
+    // Square of the pushed box, only meaningful for pushes.
+    BoardSquare box() const {
+      return BoardSquare((data_ & ~kMacroFlag) >> kSquareShift);
     }
 
-    uint8_t as_packed_int() const;
+    uint16_t as_packed_int() const;
 
-    uint8_t as_nn_index() const;
+    uint16_t as_nn_index() const;
 
     bool operator==(const Move& other) const {
       return data_ == other.data_;
     }
 
     std::string as_string() const {
+      std::string result;
       switch (direction()) {
       case Direction::Up:
-        return "up";
+        result = "up";
+        break;
       case Direction::Down:
-        return "down";
+        result = "down";
+        break;
       case Direction::Left:
-        return "left";
+        result = "left";
+        break;
       case Direction::Right:
-        return "right";
+        result = "right";
+        break;
+      }
+      if (is_push()) {
+        result += "@" + std::to_string(box().row()) + "," +
+          std::to_string(box().col());
+        if (is_macro()) result += "+";
+      }
+      return result;
+    }
+
+  private:
+    static constexpr std::uint16_t kDirectionMask = 0x3;
+    static constexpr std::uint16_t kPushFlag = 0x4;
+    static constexpr int kSquareShift = 3;
+    static constexpr std::uint16_t kMacroFlag = 0x8000;
+
+    uint16_t data_ = 0;
+  };
+
+  // Number of NN policy outputs for step and push moves respectively.
+  constexpr int kNumStepPolicies = 4;
+  constexpr int kNumPushPolicies = kNumSquares * 4;
+
+  inline Move::Direction Opposite(Move::Direction dir) {
+    return Move::Direction(static_cast<std::uint8_t>(dir) ^ 1);
+  }
+
+  // Set of board squares, stored as one 64-bit word per row. Square N is
+  // bit N % 64 of word N / 64. Boards with fewer rows only cover the bottom
+  // of the square numbering and are used for levels which fit them.
+  template <int kRows>
+  class BitBoardT {
+  public:
+    static constexpr int kWords = kRows;
+
+    BitBoardT() = default;
+    BitBoardT(const BitBoardT&) = default;
+    BitBoardT& operator=(const BitBoardT&) = default;
+
+    // Copies the rows both boards have, any other rows are empty.
+    template <int kOtherRows>
+    explicit BitBoardT(const BitBoardT<kOtherRows>& other) {
+      for (int i = 0; i < std::min(kRows, kOtherRows); i++) {
+        board_[i] = other.word(i);
+      }
+    }
+
+    // Squares of the given row, column 0 is the lowest bit.
+    std::uint64_t word(int idx) const { return board_[idx]; }
+
+    void clear() {
+      for (auto& w : board_) w = 0;
+    }
+
+    void set(BoardSquare square) { set(square.as_int()); }
+    void set(std::uint16_t pos) {
+      assert(pos / 64 < kWords);
+      board_[pos / 64] |= 1ull << (pos % 64);
+    }
+    void set(int row, int col) { set(BoardSquare(row, col)); }
+
+    void reset(BoardSquare square) { reset(square.as_int()); }
+    void reset(std::uint16_t pos) { board_[pos / 64] &= ~(1ull << (pos % 64)); }
+    void reset(int row, int col) { reset(BoardSquare(row, col)); }
+
+    bool get(BoardSquare square) const { return get(square.as_int()); }
+    bool get(std::uint16_t pos) const {
+      return (board_[pos / 64] >> (pos % 64)) & 1;
+    }
+    bool get(int row, int col) const { return get(BoardSquare(row, col)); }
+
+    bool empty() const {
+      std::uint64_t acc = 0;
+      for (auto w : board_) acc |= w;
+      return acc == 0;
+    }
+
+    int count() const {
+      int result = 0;
+      for (auto w : board_) result += __builtin_popcountll(w);
+      return result;
+    }
+
+    // Whether two boards have at least one square in common.
+    bool intersects(const BitBoardT& other) const {
+      std::uint64_t acc = 0;
+      for (int i = 0; i < kWords; i++) acc |= board_[i] & other.board_[i];
+      return acc != 0;
+    }
+
+    // Lowest set square. The board must not be empty.
+    BoardSquare first() const {
+      for (int i = 0; i < kWords; i++) {
+        if (board_[i]) return BoardSquare(i * 64 + __builtin_ctzll(board_[i]));
       }
       assert(false);
-      return "Error!";
+      return BoardSquare();
     }
 
+    // Board moved by one square in the given direction. Squares which would
+    // leave the board are dropped.
+    BitBoardT Shifted(Move::Direction dir) const {
+      switch (dir) {
+      case Move::Direction::Up:
+        return ShiftedRows(1);
+      case Move::Direction::Down:
+        return ShiftedRows(-1);
+      case Move::Direction::Left:
+        return ShiftedCols(-1);
+      case Move::Direction::Right:
+        return ShiftedCols(1);
+      }
+      assert(false);
+      return BitBoardT();
+    }
+
+    // Kogge-Stone occluded fill: extends every square of this board in the
+    // given direction for as long as it stays inside `empty`.
+    BitBoardT Filled(Move::Direction dir, BitBoardT empty) const {
+      BitBoardT gen = *this;
+      switch (dir) {
+      case Move::Direction::Up:
+      case Move::Direction::Down: {
+        const int sign = dir == Move::Direction::Up ? 1 : -1;
+        for (int shift = 1; shift < kRows; shift *= 2) {
+          gen |= empty & gen.ShiftedRows(sign * shift);
+          empty &= empty.ShiftedRows(sign * shift);
+        }
+        break;
+      }
+      case Move::Direction::Left:
+      case Move::Direction::Right: {
+        // Rows don't interact, so every word is filled on its own.
+        const bool right = dir == Move::Direction::Right;
+        for (int i = 0; i < kWords; i++) {
+          std::uint64_t g = gen.board_[i];
+          std::uint64_t e = empty.board_[i];
+          for (int shift = 1; shift < 64; shift *= 2) {
+            g |= e & (right ? g << shift : g >> shift);
+            e &= right ? e << shift : e >> shift;
+          }
+          gen.board_[i] = g;
+        }
+        break;
+      }
+      }
+      return gen;
+    }
+
+    // All squares of `empty` connected to this board through `empty`.
+    BitBoardT FloodFilled(const BitBoardT& empty) const {
+      BitBoardT result = *this & empty;
+      while (true) {
+        BitBoardT next = result;
+        next = next.Filled(Move::Direction::Up, empty);
+        next = next.Filled(Move::Direction::Down, empty);
+        next = next.Filled(Move::Direction::Left, empty);
+        next = next.Filled(Move::Direction::Right, empty);
+        if (next == result) return result;
+        result = next;
+      }
+    }
+
+    // Squares on the board which are not in this one.
+    BitBoardT operator~() const {
+      BitBoardT result;
+      for (int i = 0; i < kWords; i++) result.board_[i] = ~board_[i];
+      return result;
+    }
+
+    BitBoardT operator&(const BitBoardT& other) const {
+      BitBoardT result;
+      for (int i = 0; i < kWords; i++) result.board_[i] = board_[i] & other.board_[i];
+      return result;
+    }
+
+    BitBoardT operator|(const BitBoardT& other) const {
+      BitBoardT result;
+      for (int i = 0; i < kWords; i++) result.board_[i] = board_[i] | other.board_[i];
+      return result;
+    }
+
+    BitBoardT operator^(const BitBoardT& other) const {
+      BitBoardT result;
+      for (int i = 0; i < kWords; i++) result.board_[i] = board_[i] ^ other.board_[i];
+      return result;
+    }
+
+    // Squares of this board which are not in the other one.
+    BitBoardT operator-(const BitBoardT& other) const {
+      BitBoardT result;
+      for (int i = 0; i < kWords; i++) result.board_[i] = board_[i] & ~other.board_[i];
+      return result;
+    }
+
+    BitBoardT& operator&=(const BitBoardT& other) { return *this = *this & other; }
+    BitBoardT& operator|=(const BitBoardT& other) { return *this = *this | other; }
+    BitBoardT& operator^=(const BitBoardT& other) { return *this = *this ^ other; }
+    BitBoardT& operator-=(const BitBoardT& other) { return *this = *this - other; }
+
+    bool operator==(const BitBoardT& other) const {
+      std::uint64_t acc = 0;
+      for (int i = 0; i < kWords; i++) acc |= board_[i] ^ other.board_[i];
+      return acc == 0;
+    }
+    bool operator!=(const BitBoardT& other) const {
+      return !operator==(other);
+    }
+
+    // Iterates over set squares, lowest first.
+    class Iterator {
+    public:
+      Iterator(const std::uint64_t* words, int idx) : words_(words), idx_(idx) {
+        Advance();
+      }
+
+      BoardSquare operator*() const {
+        return BoardSquare(idx_ * 64 + __builtin_ctzll(current_));
+      }
+
+      void operator++() {
+        current_ &= current_ - 1;
+        if (!current_) {
+          ++idx_;
+          Advance();
+        }
+      }
+
+      bool operator!=(const Iterator& other) const {
+        return idx_ != other.idx_ || current_ != other.current_;
+      }
+
+    private:
+      void Advance() {
+        for (; idx_ < kWords; ++idx_) {
+          current_ = words_[idx_];
+          if (current_) return;
+        }
+        current_ = 0;
+      }
+
+      const std::uint64_t* words_;
+      int idx_;
+      std::uint64_t current_ = 0;
+    };
+
+    Iterator begin() const { return Iterator(board_, 0); }
+    Iterator end() const { return Iterator(board_, kWords); }
+
   private:
-    uint8_t data_ = 0;
+    // Moves every square by `rows` rows, up for positive values.
+    BitBoardT ShiftedRows(int rows) const {
+      BitBoardT result;
+      for (int i = std::max(0, rows); i < std::min(kWords, kWords + rows); i++) {
+        result.board_[i] = board_[i - rows];
+      }
+      return result;
+    }
+
+    // Moves every square by `cols` columns, right for positive values.
+    BitBoardT ShiftedCols(int cols) const {
+      BitBoardT result;
+      for (int i = 0; i < kWords; i++) {
+        result.board_[i] = cols > 0 ? board_[i] << cols : board_[i] >> -cols;
+      }
+      return result;
+    }
+
+    alignas(16) std::uint64_t board_[kWords] = {};
   };
 
+  template <int kRows>
+  constexpr int BitBoardT<kRows>::kWords;
+
+  using BitBoard = BitBoardT<kMaxBoardSize>;
+
+  // Most boxes a level may have.
+  constexpr int kMaxBoxes = 128;
 
-  using MoveList = std::vector<Move>;
+  // Upper bound on legal moves in a position, four pushes for each box.
+  constexpr int kMaxMoves = 4 * kMaxBoxes;
+
+  // Move list with fixed capacity so move generation never allocates.
+  class MoveList {
+  public:
+    using value_type = Move;
+    using iterator = Move*;
+    using const_iterator = const Move*;
+
+    MoveList() = default;
+    MoveList(std::initializer_list<Move> moves) : size_(moves.size()) {
+      assert(moves.size() <= kMaxMoves);
+      std::copy(moves.begin(), moves.end(), moves_);
+    }
+    MoveList(const MoveList& other) : size_(other.size_) {
+      std::copy(other.begin(), other.end(), moves_);
+    }
+    MoveList& operator=(const MoveList& other) {
+      size_ = other.size_;
+      std::copy(other.begin(), other.end(), moves_);
+      return *this;
+    }
+
+    void push_back(Move move) {
+      assert(size_ < kMaxMoves);
+      moves_[size_++] = move;
+    }
+    template <typename... Args>
+    void emplace_back(Args&&... args) {
+      assert(size_ < kMaxMoves);
+      moves_[size_++] = Move(std::forward<Args>(args)...);
+    }
+    void clear() { size_ = 0; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    Move& operator[](size_t idx) { return moves_[idx]; }
+    Move operator[](size_t idx) const { return moves_[idx]; }
+    Move front() const { return moves_[0]; }
+    Move back() const { return moves_[size_ - 1]; }
+
+    iterator begin() { return moves_; }
+    iterator end() { return moves_ + size_; }
+    const_iterator begin() const { return moves_; }
+    const_iterator end() const { return moves_ + size_; }
+
+    bool operator==(const MoveList& other) const {
+      return size_ == other.size_ && std::equal(begin(), end(), other.begin());
+    }
+    bool operator!=(const MoveList& other) const { return !(*this == other); }
+
+  private:
+    size_t size_ = 0;
+    Move moves_[kMaxMoves];
+  };
 } // namespace pzero
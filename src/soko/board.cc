@@ -1,9 +1,15 @@
 #include "soko/board.h"
 
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <cstdlib>
-#include <cstring>
-#include <map>
+#include <set>
+#include <unordered_map>
+#include "soko/deadlocks.h"
+#include "soko/matching.h"
 #include "utils/exception.h"
+#include "utils/mutex.h"
 
 namespace pzero {
 
@@ -24,7 +30,7 @@ namespace pzero {
 
 
   void SokoBoard::Clear() {
-    std::memset(reinterpret_cast<void*>(this), 0, sizeof(SokoBoard));
+    *this = SokoBoard();
   }
 
   namespace {
@@ -37,153 +43,880 @@ namespace pzero {
     };
 
 
-    static const std::pair<Move::Direction, Move::Direction> kStuckChecks[] =
-      {
-        {Move::Direction::Up,
-         Move::Direction::Left},
-        {Move::Direction::Up,
-         Move::Direction::Right},
-        {Move::Direction::Down,
-         Move::Direction::Left},
-        {Move::Direction::Down,
-         Move::Direction::Right}
-      };
-
-    static const std::map<Move::Direction, std::pair<Move::Direction, Move::Direction>> kStuckChecks2 = {
-      {Move::Direction::Up, {
-          Move::Direction::Left,
-          Move::Direction::Right
-        }},
-      {Move::Direction::Down, {
-          Move::Direction::Left,
-          Move::Direction::Right
-        }},
-      {Move::Direction::Left, {
-          Move::Direction::Up,
-          Move::Direction::Down
-        }},
-      {Move::Direction::Right, {
-          Move::Direction::Up,
-          Move::Direction::Down
-        }}
+    struct ZobristKeys {
+      std::uint64_t boxes[kNumSquares] = {};
+      std::uint64_t player[kNumSquares] = {};
     };
-    
-    static const std::map<Move::Direction, std::pair<int, int>> kCharMoves = {
-      {Move::Direction::Up, {1, 0}},
-      {Move::Direction::Down, {-1, 0}},
-      {Move::Direction::Left, {0, -1}},
-      {Move::Direction::Right, {0, 1}}
+
+    // splitmix64, so that keys are the same in every build.
+    constexpr std::uint64_t NextZobristKey(std::uint64_t& state) {
+      std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+
+    constexpr ZobristKeys MakeZobristKeys() {
+      ZobristKeys keys;
+      std::uint64_t state = 0x2545f4914f6cdd1dull;
+      for (int i = 0; i < kNumSquares; i++) {
+        keys.boxes[i] = NextZobristKey(state);
+        keys.player[i] = NextZobristKey(state);
+      }
+      return keys;
+    }
+
+    constexpr ZobristKeys kZobrist = MakeZobristKeys();
+
+    // Square index offsets, indexed by Move::Direction.
+    static const int kSquareDeltas[4] = {
+      kMaxBoardSize, -kMaxBoardSize, -1, 1
     };
 
   } // namespace
 
   void AddDirection(const BoardSquare& source, BoardSquare& dest, Move::Direction dir) {
-    const auto& delta = kCharMoves.at(dir);
-
-    const auto dst_row = source.row() + delta.first;
-    const auto dst_col = source.col() + delta.second;
-    dest.set(dst_row, dst_col);
+    dest = BoardSquare(source.as_int() + kSquareDeltas[static_cast<int>(dir)]);
   }
 
-  void SokoBoard::ApplyMove(Move move) {
-    const auto& from = char_;
+  // The hot parts of move generation and deadlock detection, compiled for
+  // the number of rows a level needs so that they only touch the words in
+  // use. Most levels fit 16 rows and run on a quarter of the full board.
+  struct BoardKernels {
+    BitBoard (*player_reachable)(const SokoBoard& board);
+    std::array<BitBoard, 4> (*generate_pushes)(const SokoBoard& board,
+                                               const BitBoard& reachable);
+    bool (*is_stuck)(const SokoBoard& board);
+    // Whether the box can't move along either axis anymore, held by boxes
+    // of which at least one is off target.
+    bool (*is_frozen)(const SokoBoard& board, BoardSquare box);
+    // Player steps along a shortest walk to `to` which pushes no box, false
+    // if there is none.
+    bool (*walk)(const SokoBoard& board, BoardSquare to,
+                 std::vector<Move>* steps);
+    BitBoard (*flood_filled)(const BitBoard& seed, const BitBoard& empty);
+    BitBoard (*neighbours)(const BitBoard& region);
+    // Squares of `inside` from which a box can be pushed onto a target.
+    BitBoard (*live_squares)(const BitBoard& targets, const BitBoard& inside);
+  };
+
+  namespace {
+
+    template <int kRows>
+    BitBoard PlayerReachable(const SokoBoard& board) {
+      using Narrow = BitBoardT<kRows>;
+      Narrow player;
+      player.set(board.king());
+      return BitBoard(player.FloodFilled(
+        ~(Narrow(board.walls()) | Narrow(board.boxes()))));
+    }
+
+    template <int kRows>
+    std::array<BitBoard, 4> GeneratePushes(const SokoBoard& board,
+                                           const BitBoard& reachable_rows) {
+      using Narrow = BitBoardT<kRows>;
+      const Narrow boxes(board.boxes());
+      const Narrow reachable(reachable_rows);
+      const Narrow empty = ~(Narrow(board.walls()) | boxes);
+      std::array<BitBoard, 4> result;
+
+      for (const auto dir : kDirections) {
+        // A box can be pushed towards `dir` when the player reaches the
+        // square behind it and the square in front of it is empty.
+        result[static_cast<int>(dir)] = BitBoard(boxes &
+          reachable.Shifted(dir) &
+          empty.Shifted(Opposite(dir)));
+      }
+      return result;
+    }
+
+    template <int kRows>
+    bool IsStuck(const SokoBoard& board) {
+      using Narrow = BitBoardT<kRows>;
+      const Narrow boxes(board.boxes());
+      if (boxes.intersects(Narrow(board.dead_squares()))) return true;
+
+      // Two adjacent boxes along a wall can't be moved anymore, unless both
+      // are already on targets.
+      const Narrow walls(board.walls());
+      const Narrow off_target = boxes - Narrow(board.targets());
+
+      const Narrow wall_up = walls.Shifted(Move::Direction::Down);
+      const Narrow wall_down = walls.Shifted(Move::Direction::Up);
+      const Narrow right_box = boxes & boxes.Shifted(Move::Direction::Left);
+      const Narrow horizontal =
+        (wall_up & wall_up.Shifted(Move::Direction::Left)) |
+        (wall_down & wall_down.Shifted(Move::Direction::Left));
+      if (right_box.intersects(horizontal &
+            (off_target | off_target.Shifted(Move::Direction::Left)))) {
+        return true;
+      }
+
+      const Narrow wall_left = walls.Shifted(Move::Direction::Right);
+      const Narrow wall_right = walls.Shifted(Move::Direction::Left);
+      const Narrow upper_box = boxes & boxes.Shifted(Move::Direction::Down);
+      const Narrow vertical =
+        (wall_left & wall_left.Shifted(Move::Direction::Down)) |
+        (wall_right & wall_right.Shifted(Move::Direction::Down));
+      return upper_box.intersects(vertical &
+        (off_target | off_target.Shifted(Move::Direction::Down)));
+    }
+
+    // Squares outside of the rows a kernel covers count as walls.
+    template <int kRows>
+    bool OnBoard(BoardSquare square) {
+      return square.as_int() < kRows * kMaxBoardSize;
+    }
+
+    template <int kRows>
+    bool IsFrozen(const SokoBoard& board, BoardSquare box,
+                  BitBoardT<kRows>* obstacles, bool* off_target);
+
+    template <int kRows>
+    bool IsBlocked(const SokoBoard& board, BoardSquare box,
+                   Move::Direction dir, BitBoardT<kRows>* obstacles,
+                   bool* off_target) {
+      BoardSquare first;
+      BoardSquare second;
+      AddDirection(box, first, dir);
+      AddDirection(box, second, Opposite(dir));
+
+      if (!OnBoard<kRows>(first) || !OnBoard<kRows>(second) ||
+          obstacles->get(first) || obstacles->get(second)) {
+        return true;
+      }
+      if (board.dead_squares().get(first) &&
+          board.dead_squares().get(second)) {
+        return true;
+      }
+
+      return (board.boxes().get(first) &&
+              IsFrozen(board, first, obstacles, off_target)) ||
+        (board.boxes().get(second) &&
+         IsFrozen(board, second, obstacles, off_target));
+    }
+
+    template <int kRows>
+    bool IsFrozen(const SokoBoard& board, BoardSquare box,
+                  BitBoardT<kRows>* obstacles, bool* off_target) {
+      // While its neighbours are examined the box counts as a wall, which
+      // breaks cycles between boxes blocking each other.
+      obstacles->set(box);
+
+      const bool frozen =
+        IsBlocked(board, box, Move::Direction::Up, obstacles, off_target) &&
+        IsBlocked(board, box, Move::Direction::Left, obstacles, off_target);
+
+      if (!frozen) {
+        obstacles->reset(box);
+        return false;
+      }
+
+      if (!board.targets().get(box)) *off_target = true;
+      return true;
+    }
+
+    template <int kRows>
+    bool IsFrozenOffTarget(const SokoBoard& board, BoardSquare box) {
+      BitBoardT<kRows> obstacles(board.walls());
+      bool off_target = false;
+      return IsFrozen(board, box, &obstacles, &off_target) && off_target;
+    }
+
+    template <int kRows>
+    bool Walk(const SokoBoard& board, BoardSquare to,
+              std::vector<Move>* steps) {
+      using Narrow = BitBoardT<kRows>;
+      // Breadth-first search from the player.
+      const Narrow empty = ~(Narrow(board.walls()) | Narrow(board.boxes()));
+      std::uint16_t previous[kRows * kMaxBoardSize];
+      Narrow visited;
+      std::vector<BoardSquare> queue = {board.king()};
+      visited.set(board.king());
+
+      for (size_t i = 0; i < queue.size() && !visited.get(to); i++) {
+        for (const auto dir : kDirections) {
+          BoardSquare next;
+          AddDirection(queue[i], next, dir);
+          if (!OnBoard<kRows>(next) || visited.get(next) || !empty.get(next)) {
+            continue;
+          }
+          visited.set(next);
+          previous[next.as_int()] = queue[i].as_int();
+          queue.push_back(next);
+        }
+      }
+
+      if (!OnBoard<kRows>(to) || !visited.get(to)) return false;
+
+      const size_t begin = steps->size();
+      for (BoardSquare sq = to; !(sq == board.king());
+           sq = previous[sq.as_int()]) {
+        for (const auto dir : kDirections) {
+          BoardSquare from;
+          AddDirection(sq, from, Opposite(dir));
+          if (from == BoardSquare(previous[sq.as_int()])) {
+            steps->emplace_back(dir);
+            break;
+          }
+        }
+      }
+      std::reverse(steps->begin() + begin, steps->end());
+      return true;
+    }
+
+    template <int kRows>
+    BitBoard FloodFilled(const BitBoard& seed, const BitBoard& empty) {
+      using Narrow = BitBoardT<kRows>;
+      return BitBoard(Narrow(seed).FloodFilled(Narrow(empty)));
+    }
+
+    template <int kRows>
+    BitBoard Neighbours(const BitBoard& region_rows) {
+      const BitBoardT<kRows> region(region_rows);
+      return BitBoard(region.Shifted(Move::Direction::Up) |
+                      region.Shifted(Move::Direction::Down) |
+                      region.Shifted(Move::Direction::Left) |
+                      region.Shifted(Move::Direction::Right));
+    }
+
+    template <int kRows>
+    BitBoard LiveSquares(const BitBoard& targets, const BitBoard& inside_rows) {
+      using Narrow = BitBoardT<kRows>;
+      // Pull boxes backwards from every target. A box can be pulled from q
+      // to q - d when both q - d and q - 2d are inside the level.
+      const Narrow inside(inside_rows);
+      Narrow live(targets);
+      while (true) {
+        Narrow next = live;
+        for (const auto dir : kDirections) {
+          next = next.Filled(Opposite(dir), inside & inside.Shifted(dir));
+        }
+        if (next == live) return BitBoard(live);
+        live = next;
+      }
+    }
+
+    template <int kRows>
+    constexpr BoardKernels MakeKernels() {
+      return {&PlayerReachable<kRows>, &GeneratePushes<kRows>,
+              &IsStuck<kRows>, &IsFrozenOffTarget<kRows>, &Walk<kRows>,
+              &FloodFilled<kRows>, &Neighbours<kRows>, &LiveSquares<kRows>};
+    }
+
+    constexpr BoardKernels kKernels[] = {
+      MakeKernels<8>(), MakeKernels<16>(), MakeKernels<32>(),
+      MakeKernels<kMaxBoardSize>()
+    };
+
+    // Smallest specialization with room for the level.
+    const BoardKernels* SelectKernels(int rows) {
+      if (rows <= 8) return &kKernels[0];
+      if (rows <= 16) return &kKernels[1];
+      if (rows <= 32) return &kKernels[2];
+      return &kKernels[3];
+    }
+
+  } // namespace
+
+  bool SokoBoard::IsLegal(Move move) const {
+    if (move.is_push()) {
+      return GeneratePushes()[static_cast<int>(move.direction())].get(move.box());
+    }
+
     BoardSquare to;
     BoardSquare to2;
-    
-    AddDirection(from, to, move.direction());
+    AddDirection(char_, to, move.direction());
     AddDirection(to, to2, move.direction());
 
-    if (walls_.get(to)) {
-      throw Exception("bad move");
+    if (walls().get(to)) return false;
+    return !boxes_.get(to) || !(walls().get(to2) || boxes_.get(to2));
+  }
+
+  void SokoBoard::ApplyMove(Move move) {
+    if (!IsLegal(move)) throw Exception("bad move");
+    DoMove(move);
+  }
+
+  SokoBoard::UndoInfo SokoBoard::DoMove(Move move) {
+    assert(IsLegal(move));
+    const UndoInfo undo = {char_, last_push_, pushed_};
+
+    // Pushes teleport the player behind the box, steps only move it by one.
+    BoardSquare to;
+    if (move.is_push()) {
+      to = move.box();
+    } else {
+      AddDirection(char_, to, move.direction());
+    }
+
+    pushed_ = boxes_.get(to);
+    if (pushed_) {
+      AddDirection(to, last_push_, move.direction());
+      MoveBox(to, last_push_);
     }
+    MovePlayer(to);
+    if (move.is_macro()) ContinueMacro(move.direction(), nullptr);
+    return undo;
+  }
 
-    if (boxes_.get(to)) {
-      if (walls_.get(to2) || boxes_.get(to2)) {
-        throw Exception("bad move");
+  void SokoBoard::UndoMove(Move move, const UndoInfo& undo) {
+    if (pushed_) {
+      // Macros may have carried the box further than one square.
+      BoardSquare from = move.box();
+      if (!move.is_push()) {
+        AddDirection(last_push_, from, Opposite(move.direction()));
       }
-      // push
-      boxes_.reset(to);
-      boxes_.set(to2);
+      MoveBox(last_push_, from);
     }
+    MovePlayer(undo.player);
+    last_push_ = undo.last_push;
+    pushed_ = undo.pushed;
+  }
+
+  void SokoBoard::MovePlayer(BoardSquare to) {
+    hash_ ^= kZobrist.player[char_.as_int()] ^ kZobrist.player[to.as_int()];
     char_ = to;
   }
 
-  bool SokoBoard::IsEnd() const {
-    return boxes_.intersects(targets_);
+  bool SokoBoard::EntersGoalRoom(BoardSquare box, Move::Direction dir) const {
+    const auto& room = level_->goal_room();
+    if (room.slots.empty() || !(box == room.entrance) ||
+        dir != room.direction) {
+      return false;
+    }
+    // The room must hold boxes on exactly the slots filled before.
+    const size_t parked = (boxes_ & room.squares).count();
+    if (parked >= room.slots.size()) return false;
+    for (size_t i = 0; i < parked; i++) {
+      if (!boxes_.get(room.slots[i])) return false;
+    }
+    return true;
+  }
+
+  bool SokoBoard::ContinuesTunnel(BoardSquare box, Move::Direction dir) const {
+    const BitBoard& tunnels = level_->tunnels(dir);
+    BoardSquare player;
+    BoardSquare next;
+    AddDirection(box, player, Opposite(dir));
+    AddDirection(box, next, dir);
+    return tunnels.get(box) && tunnels.get(player) && !targets().get(box) &&
+      !walls().get(next) && !boxes_.get(next) && !dead_squares().get(next);
+  }
+
+  void SokoBoard::ContinueMacro(Move::Direction dir, std::vector<Move>* pushes) {
+    const auto push = [&](Move move) {
+      if (pushes) pushes->push_back(move);
+      AddDirection(move.box(), last_push_, move.direction());
+      MoveBox(move.box(), last_push_);
+      MovePlayer(move.box());
+    };
+
+    if (EntersGoalRoom(last_push_, dir)) {
+      const auto& room = level_->goal_room();
+      for (const auto move : room.pushes[(boxes_ & room.squares).count()]) {
+        push(move);
+      }
+      return;
+    }
+    while (ContinuesTunnel(last_push_, dir)) push(Move(last_push_, dir));
+  }
+
+  void SokoBoard::MoveBox(BoardSquare from, BoardSquare to) {
+    boxes_.reset(from);
+    boxes_.set(to);
+    hash_ ^= kZobrist.boxes[from.as_int()] ^ kZobrist.boxes[to.as_int()];
+    boxes_off_target_ += targets().get(from) - targets().get(to);
+    if (matching_) {
+      // Copied only while another board still shares it.
+      if (matching_.use_count() > 1) {
+        matching_ = std::make_shared<BoxMatching>(*matching_);
+      }
+      matching_->MoveBox(*level_, from, to);
+    }
+  }
+
+  int SokoBoard::LowerBound() const {
+    if (!matching_) matching_ = std::make_shared<BoxMatching>(*level_, boxes_);
+    return matching_->cost(*level_);
+  }
+
+  std::uint64_t SokoBoard::NormalizedHash(const BitBoard& reachable) const {
+    return hash_ ^ kZobrist.player[char_.as_int()] ^
+      kZobrist.player[reachable.first().as_int()];
+  }
+
+  SokoBoard SokoBoard::WithBoxes(const BitBoard& boxes) const {
+    SokoBoard result = *this;
+    result.boxes_ = boxes;
+    result.hash_ = result.ComputeHash();
+    result.boxes_off_target_ = (boxes - targets()).count();
+    result.pushed_ = false;
+    result.matching_.reset();
+    return result;
+  }
+
+  SokoBoard::CanonicalKey SokoBoard::Canonical() const {
+    CanonicalKey result = {hash_, kIdentity};
+    for (const auto transform : level_->symmetries()) {
+      if (transform == kIdentity) continue;
+      std::uint64_t hash =
+        kZobrist.player[level_->Apply(transform, char_).as_int()];
+      for (const auto box : boxes_) {
+        hash ^= kZobrist.boxes[level_->Apply(transform, box).as_int()];
+      }
+      if (hash < result.hash) result = {hash, transform};
+    }
+    return result;
+  }
+
+  SokoBoard SokoBoard::Transformed(Transform transform) const {
+    SokoBoard result = *this;
+    result.boxes_.clear();
+    for (const auto box : boxes_) {
+      result.boxes_.set(level_->Apply(transform, box));
+    }
+    result.char_ = level_->Apply(transform, char_);
+    result.last_push_ = level_->Apply(transform, last_push_);
+    result.hash_ = result.ComputeHash();
+    result.matching_.reset();
+    return result;
+  }
+
+  std::uint64_t SokoBoard::ComputeHash() const {
+    std::uint64_t hash = kZobrist.player[char_.as_int()];
+    for (const auto box : boxes_) hash ^= kZobrist.boxes[box.as_int()];
+    return hash;
   }
 
   bool SokoBoard::IsStuck() const {
+    return level_->kernels().is_stuck(*this);
+  }
 
-    for (unsigned square = 0; square < 400; square++) {
-      const BoardSquare b_sq(square);
-
-      if (boxes_.get(b_sq)) {
-        for (auto check : kStuckChecks) {
-          BoardSquare c1;
-          BoardSquare c2;
-          AddDirection(b_sq, c1, check.first);
-          AddDirection(b_sq, c2, check.second);
-          if (walls_.get(c1) && walls_.get(c2)) {
-            return true;
+  bool SokoBoard::IsFreezeDeadlock() const {
+    if (!pushed_) return false;
+
+    return level_->kernels().is_frozen(*this, last_push_);
+  }
+
+  bool SokoBoard::IsPatternDeadlock() const {
+    if (!pushed_) return false;
+
+    std::uint32_t index =
+      targets().get(last_push_) ? 1u << kPatternCenterBit : 0;
+    int shift = 0;
+    for (int row = last_push_.row() - 1; row <= last_push_.row() + 1; ++row) {
+      for (int col = last_push_.col() - 1; col <= last_push_.col() + 1; ++col) {
+        const BoardSquare square(row, col);
+        if (square == last_push_) continue;
+        std::uint32_t cell = kPatternWall;
+        if (row >= 0 && row < kMaxBoardSize && col >= 0 && col < kMaxBoardSize &&
+            !walls().get(square)) {
+          cell = !boxes_.get(square) ? kPatternFloor :
+            targets().get(square) ? kPatternBoxOnTarget : kPatternBox;
+        }
+        index |= cell << shift;
+        shift += kPatternCellBits;
+      }
+    }
+    return IsDeadlockPattern(index);
+  }
+
+  constexpr int Level::kUnreachable;
+
+  Level::Level(int rows, int cols, const BitBoard& walls,
+               const BitBoard& targets, BoardSquare player)
+    : rows_(rows), cols_(cols), kernels_(SelectKernels(rows)),
+      walls_(walls), targets_(targets) {
+    BitBoard start;
+    start.set(player);
+    inside_ = kernels_->flood_filled(start, ~walls_);
+    const BitBoard& inside = inside_;
+
+    dead_squares_ = inside - kernels_->live_squares(targets_, inside);
+
+    for (const auto dir : {Move::Direction::Up, Move::Direction::Left}) {
+      const auto side = dir == Move::Direction::Up ?
+        Move::Direction::Left : Move::Direction::Up;
+      tunnels_[static_cast<int>(dir) / 2] = inside & walls_.Shifted(side) &
+        walls_.Shifted(Opposite(side));
+    }
+    FindGoalRoom(inside, player);
+
+    // Push distances by breadth first search of pulls from each target.
+    const int table_size = rows_ * kMaxBoardSize;
+    for (const auto target : targets_) target_squares_.push_back(target);
+    push_distances_.assign(target_squares_.size() * table_size, kUnreachable);
+    std::vector<BoardSquare> queue;
+    for (size_t i = 0; i < target_squares_.size(); i++) {
+      std::uint16_t* distances = &push_distances_[i * table_size];
+      distances[target_squares_[i].as_int()] = 0;
+      queue.assign(1, target_squares_[i]);
+      for (size_t head = 0; head < queue.size(); head++) {
+        const int box = queue[head].as_int();
+        for (const int delta : kSquareDeltas) {
+          const int from = box - delta;
+          const int player = from - delta;
+          if (player < 0 || player >= table_size || from >= table_size) {
+            continue;
           }
+          if (!inside.get(BoardSquare(from)) ||
+              !inside.get(BoardSquare(player)) ||
+              distances[from] != kUnreachable) {
+            continue;
+          }
+          distances[from] = distances[box] + 1;
+          queue.emplace_back(from);
         }
+      }
+    }
+
+    for (int i = 0; i < kNumTransforms; i++) {
+      const auto transform = static_cast<Transform>(i);
+      if (transform >= kTranspose && rows_ != cols_) break;
+      BitBoard image_walls;
+      BitBoard image_targets;
+      for (const auto square : walls_) image_walls.set(Apply(transform, square));
+      for (const auto square : targets_) {
+        image_targets.set(Apply(transform, square));
+      }
+      if (image_walls == walls_ && image_targets == targets_) {
+        symmetries_.push_back(transform);
+      }
+    }
+  }
+
+  BitBoard Level::FloodFilled(const BitBoard& seed,
+                              const BitBoard& empty) const {
+    return kernels_->flood_filled(seed, empty);
+  }
+
+  BitBoard Level::Neighbours(const BitBoard& region) const {
+    return kernels_->neighbours(region);
+  }
+
+  namespace {
+    Mutex gLevelsMutex;
+    // Every level handed out by Level::Get, by a description of its walls,
+    // targets and starting square.
+    std::unordered_map<std::string, std::unique_ptr<const Level>> gLevels
+      GUARDED_BY(gLevelsMutex);
+  } // namespace
 
-        for (auto check2 : kStuckChecks2) {
-          BoardSquare b2;
-          AddDirection(b_sq, b2, check2.first);
-          if (boxes_.get(b2)) {
-            BoardSquare c1;
-            BoardSquare c2;
-            BoardSquare c3;
-            BoardSquare c4;
-            AddDirection(b_sq, c1, check2.second.first);
-            AddDirection(b2, c2, check2.second.first);
-
-            AddDirection(b_sq, c3, check2.second.second);
-            AddDirection(b2, c4, check2.second.second);
-
-            if ((walls_.get(c1) && walls_.get(c2)) ||
-                (walls_.get(c3) && walls_.get(c4))) {
-              return true;
-            }
+  const Level* Level::Get(int rows, int cols, const BitBoard& walls,
+                          const BitBoard& targets, BoardSquare player) {
+    std::string key = std::to_string(rows) + ',' + std::to_string(cols) +
+      ',' + std::to_string(player.as_int()) + ':';
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        key += '0' + walls.get(row, col) + 2 * targets.get(row, col);
+      }
+    }
+
+    Mutex::Lock lock(gLevelsMutex);
+    auto& level = gLevels[key];
+    if (!level) {
+      level = std::make_unique<const Level>(rows, cols, walls, targets, player);
+    }
+    return level.get();
+  }
+
+  namespace {
+
+    // Shortest sequence of pushes bringing a box from `box` to `goal` with
+    // the player on `player`, both staying on `area`. Empty if there is none.
+    std::vector<Move> FindPushes(const BitBoard& area, BoardSquare box,
+                                 BoardSquare player, BoardSquare goal) {
+      struct State {
+        BoardSquare box;
+        BoardSquare player;
+        int parent;
+        Move push;
+      };
+      std::vector<State> states = {{box, player, -1, Move()}};
+      // Boxes positions with the player's region, keyed by its first square.
+      std::set<std::pair<int, int>> seen;
+
+      for (size_t i = 0; i < states.size(); i++) {
+        const State state = states[i];
+        if (state.box == goal) {
+          std::vector<Move> result;
+          for (int j = i; states[j].parent >= 0; j = states[j].parent) {
+            result.push_back(states[j].push);
           }
+          std::reverse(result.begin(), result.end());
+          return result;
+        }
+        // Rooms are small, a plain search is cheaper than a flood fill of
+        // the whole board.
+        BitBoard region;
+        region.set(state.player);
+        region.set(state.box);
+        std::vector<BoardSquare> queue = {state.player};
+        int first = state.player.as_int();
+        for (size_t j = 0; j < queue.size(); j++) {
+          for (const auto dir : kDirections) {
+            BoardSquare next;
+            AddDirection(queue[j], next, dir);
+            if (!area.get(next) || region.get(next)) continue;
+            region.set(next);
+            queue.push_back(next);
+            first = std::min<int>(first, next.as_int());
+          }
+        }
+        region.reset(state.box);
+        if (!seen.emplace(state.box.as_int(), first).second) continue;
+        for (const auto dir : kDirections) {
+          BoardSquare to;
+          BoardSquare behind;
+          AddDirection(state.box, to, dir);
+          AddDirection(state.box, behind, Opposite(dir));
+          if (!area.get(to) || !region.get(behind)) continue;
+          states.push_back({to, state.box, static_cast<int>(i),
+                            Move(state.box, dir)});
         }
       }
+      return {};
     }
 
-    return false;
+  } // namespace
+
+  void Level::FindGoalRoom(const BitBoard& inside, BoardSquare player) {
+    // Entrances are tunnel squares whose removal cuts every target off from
+    // the player. The smallest such room is taken.
+    const BitBoard candidates = (tunnels_[0] | tunnels_[1]) - targets_;
+    BitBoard start;
+    start.set(player);
+    for (const auto entrance : candidates) {
+      BitBoard rest = inside;
+      rest.reset(entrance);
+      const BitBoard squares = rest - kernels_->flood_filled(start, rest);
+      if (squares.empty() || !(targets_ - squares).empty()) continue;
+      if (!goal_room_.squares.empty() &&
+          squares.count() >= goal_room_.squares.count()) {
+        continue;
+      }
+      for (const auto dir : kDirections) {
+        BoardSquare next;
+        BoardSquare behind;
+        AddDirection(entrance, next, dir);
+        AddDirection(entrance, behind, Opposite(dir));
+        if (squares.get(next) && inside.get(behind) && !squares.get(behind)) {
+          goal_room_.entrance = entrance;
+          goal_room_.direction = dir;
+          goal_room_.squares = squares;
+          break;
+        }
+      }
+    }
+    if (goal_room_.squares.empty()) return;
+
+    // Fill the targets deepest first, checking each stays reachable with the
+    // earlier ones holding boxes.
+    BoardSquare behind;
+    AddDirection(goal_room_.entrance, behind,
+                 Opposite(goal_room_.direction));
+    BitBoard area = goal_room_.squares;
+    area.set(goal_room_.entrance);
+    area.set(behind);
+    BitBoard left = targets_;
+    while (!left.empty()) {
+      std::vector<Move> best;
+      BoardSquare best_slot;
+      for (const auto target : left) {
+        auto pushes = FindPushes(area, goal_room_.entrance, behind, target);
+        if (pushes.size() > best.size()) {
+          best = std::move(pushes);
+          best_slot = target;
+        }
+      }
+      if (best.empty()) {
+        goal_room_ = GoalRoom();
+        return;
+      }
+      goal_room_.slots.push_back(best_slot);
+      goal_room_.pushes.push_back(std::move(best));
+      left.reset(best_slot);
+      area.reset(best_slot);
+    }
+  }
+
+  Transform Inverse(Transform transform) {
+    switch (transform) {
+    case kRotateLeft:
+      return kRotateRight;
+    case kRotateRight:
+      return kRotateLeft;
+    default:
+      return transform;
+    }
+  }
+
+  BoardSquare Level::Apply(Transform transform, BoardSquare square) const {
+    const int row = square.row();
+    const int col = square.col();
+    const int flipped_row = rows_ - 1 - row;
+    const int flipped_col = cols_ - 1 - col;
+    switch (transform) {
+    case kIdentity:
+      return square;
+    case kFlipCols:
+      return BoardSquare(row, flipped_col);
+    case kFlipRows:
+      return BoardSquare(flipped_row, col);
+    case kFlipBoth:
+      return BoardSquare(flipped_row, flipped_col);
+    case kTranspose:
+      return BoardSquare(col, row);
+    case kRotateLeft:
+      return BoardSquare(col, flipped_row);
+    case kRotateRight:
+      return BoardSquare(flipped_col, row);
+    case kAntiTranspose:
+      return BoardSquare(flipped_col, flipped_row);
+    default:
+      assert(false);
+      return square;
+    }
+  }
+
+  Move Level::Apply(Transform transform, Move move) const {
+    // Directions follow the image of a step from the centre of the level.
+    const BoardSquare from(rows_ / 2, cols_ / 2);
+    BoardSquare to;
+    AddDirection(from, to, move.direction());
+    const int delta =
+      Apply(transform, to).as_int() - Apply(transform, from).as_int();
+    const auto dir =
+      std::find(std::begin(kSquareDeltas), std::end(kSquareDeltas), delta) -
+      std::begin(kSquareDeltas);
+    if (!move.is_push()) return Move(Move::Direction(dir));
+    return Move(Apply(transform, move.box()), Move::Direction(dir),
+                move.is_macro());
   }
 
   MoveList SokoBoard::GenerateLegalMoves() const {
     MoveList result;
-    result.reserve(4);
 
-    for (const auto& move : kCharMoves) {
-      auto source = char_;
+    for (const auto dir : kDirections) {
       BoardSquare destination;
       BoardSquare destination2;
-      AddDirection(source, destination, move.first);
-      AddDirection(destination, destination2, move.first);
+      AddDirection(char_, destination, dir);
+      AddDirection(destination, destination2, dir);
 
-      if (walls_.get(destination)) continue;
+      if (walls().get(destination)) continue;
       if (boxes_.get(destination)) {
-        if (boxes_.get(destination2) || walls_.get(destination2)) {
+        if (boxes_.get(destination2) || walls().get(destination2)) {
           continue;
         }
       }
 
-      result.emplace_back(move.first);
+      result.emplace_back(dir);
     }
 
     return result;
   }
 
+  MoveList SokoBoard::GenerateLegalPushes() const {
+    MoveList result;
+    const auto pushes = GeneratePushes();
+
+    for (const auto dir : kDirections) {
+      for (const auto box : pushes[static_cast<int>(dir)]) {
+        result.emplace_back(box, dir);
+      }
+    }
+
+    return result;
+  }
+
+  MoveList SokoBoard::GenerateLegalMacroPushes() const {
+    MoveList result;
+    const auto pushes = GeneratePushes();
+
+    for (const auto dir : kDirections) {
+      for (const auto box : pushes[static_cast<int>(dir)]) {
+        BoardSquare to;
+        AddDirection(box, to, dir);
+        result.emplace_back(box, dir, EntersGoalRoom(to, dir) ||
+                            ContinuesTunnel(to, dir));
+      }
+    }
+
+    return result;
+  }
+
+  std::vector<Move> SokoBoard::ExpandMove(Move move) const {
+    if (!move.is_push()) return {move};
+
+    if (move.is_macro()) {
+      // Expand the pushes making up the macro one by one.
+      const Move first(move.box(), move.direction());
+      std::vector<Move> pushes = {first};
+      SokoBoard board = *this;
+      board.DoMove(first);
+      board.ContinueMacro(move.direction(), &pushes);
+
+      std::vector<Move> result;
+      board = *this;
+      for (const auto push : pushes) {
+        const auto steps = board.ExpandMove(push);
+        result.insert(result.end(), steps.begin(), steps.end());
+        board.DoMove(push);
+      }
+      return result;
+    }
+
+    BoardSquare start;
+    AddDirection(move.box(), start, Opposite(move.direction()));
+
+    std::vector<Move> result;
+    if (!level_->kernels().walk(*this, start, &result)) {
+      throw Exception("bad move");
+    }
+    result.emplace_back(move.direction());
+    return result;
+  }
+
+  BitBoard SokoBoard::PlayerReachable() const {
+    return level_->kernels().player_reachable(*this);
+  }
+
+  std::array<BitBoard, 4> SokoBoard::GeneratePushes() const {
+    return GeneratePushes(PlayerReachable());
+  }
+
+  std::array<BitBoard, 4> SokoBoard::GeneratePushes(const BitBoard& reachable) const {
+    return level_->kernels().generate_pushes(*this, reachable);
+  }
+
   void SokoBoard::SetFromFen(const std::string& fen, int* moves) {
     
     Clear();
 
-    int row = 19;
+    // The level is as tall as its number of lines and as wide as the longest
+    // one.
+    int rows = 0;
+    int cols = 0;
+    int line_length = 0;
+    for (char c : fen) {
+      if (c == '\r') continue;
+      if (c == '\n') {
+        ++rows;
+        line_length = 0;
+        continue;
+      }
+      cols = std::max(cols, ++line_length);
+    }
+    if (line_length > 0) ++rows;
+    if (rows > kMaxBoardSize || cols > kMaxBoardSize) {
+      throw Exception("Level larger than 64x64: " + fen);
+    }
+
+    int row = rows - 1;
     int col = 0;
+    BitBoard walls;
+    BitBoard targets;
 
     std::istringstream fen_str(fen);
     string board;
@@ -196,51 +929,63 @@ namespace pzero {
         col = 0;
         continue;
       }
+      if (c == '\r') continue;
 
       switch (c) {
       case ' ':
+      case '-':
+      case '_':
         break;
       case '#':
-        walls_.set(row, col);
+        walls.set(row, col);
         break;
       case '.':
-        targets_.set(row, col);
+        targets.set(row, col);
         break;
       case '$':
         boxes_.set(row, col);
         break;
       case '*':
         boxes_.set(row, col);
-        targets_.set(row, col);
+        targets.set(row, col);
         break;
       case '@':
         char_.set(row, col);
         break;
       case 'o':
+      case '+':
         char_.set(row, col);
-        targets_.set(row, col);
+        targets.set(row, col);
         break;
       default:
         throw Exception("Bad fen string: " + fen);
       }
       col++;
     }
+    if (boxes_.count() > kMaxBoxes) {
+      throw Exception("Level with more than " + std::to_string(kMaxBoxes) +
+                      " boxes: " + fen);
+    }
+
+    level_ = Level::Get(rows, cols, walls, targets, char_);
+    hash_ = ComputeHash();
+    boxes_off_target_ = (boxes_ - targets).count();
   }
 
   std::string SokoBoard::DebugString() const {
     string result;
 
-    for (int i = 19; i >= 0; --i) {
-      for (int j = 0; j < 20; ++j) {
-        if (walls_.get(i, j)) {
+    for (int i = level_->rows() - 1; i >= 0; --i) {
+      for (int j = 0; j < level_->cols(); ++j) {
+        if (walls().get(i, j)) {
           result += '#';
           continue;
         }
-        if (targets_.get(i, j)) {
+        if (targets().get(i, j)) {
           if (boxes_.get(i, j)) {
             result += '*';
             continue;
-          } else if (char_ == i * 20 + j) {
+          } else if (char_ == BoardSquare(i, j)) {
             result += 'o';
             continue;
           } else {
@@ -249,7 +994,7 @@ namespace pzero {
           }
         }
 
-        if (char_ == i * 20 + j) {
+        if (char_ == BoardSquare(i, j)) {
           result += '@';
           continue;
         }
@@ -1,9 +1,134 @@
 #pragma once
 
+#include <array>
+#include <memory>
+#include <vector>
 #include "soko/bitboard.h"
 
 namespace pzero {
+
+  // Whether search moves are single player steps, whole box pushes or pushes
+  // with their forced continuations folded in.
+  enum class MoveMode { Step, Push, Macro };
   
+  struct BoardKernels;
+  class BoxMatching;
+
+  // The eight rotations and reflections of a level. Transforms past
+  // kFlipBoth swap rows and columns and only apply to square levels.
+  enum Transform : std::uint8_t {
+    kIdentity,
+    kFlipCols,
+    kFlipRows,
+    kFlipBoth,
+    kTranspose,
+    kRotateLeft,
+    kRotateRight,
+    kAntiTranspose,
+    kNumTransforms
+  };
+
+  // Transform which undoes the given one.
+  Transform Inverse(Transform transform);
+
+  // Parts of a level which never change while playing it. Shared by all
+  // boards of the level.
+  class Level {
+  public:
+    Level(int rows, int cols, const BitBoard& walls, const BitBoard& targets,
+          BoardSquare player);
+
+    // The level with these walls and targets, built on its first use. Levels
+    // handed out here are kept for the life of the process, so boards only
+    // point to theirs.
+    static const Level* Get(int rows, int cols, const BitBoard& walls,
+                            const BitBoard& targets, BoardSquare player);
+
+    // Size of the level, squares outside of it are never used.
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+
+    const BitBoard& walls() const { return walls_; }
+    const BitBoard& targets() const { return targets_; }
+
+    // Squares the player can reach from the start when there are no boxes.
+    const BitBoard& inside() const { return inside_; }
+
+    // Squares from which a box can never reach any target.
+    const BitBoard& dead_squares() const { return dead_squares_; }
+
+    // Targets in a fixed order, indexing the push distance tables.
+    const std::vector<BoardSquare>& target_squares() const {
+      return target_squares_;
+    }
+
+    static constexpr int kUnreachable = 0xffff;
+
+    // Pushes needed to bring a box on `square` to the target with the given
+    // index when no other box is in the way, kUnreachable if it never gets
+    // there.
+    int PushDistance(int target, BoardSquare square) const {
+      return push_distances_[target * rows_ * kMaxBoardSize + square.as_int()];
+    }
+
+    // Squares of one-wide corridors running along the axis of `dir`.
+    const BitBoard& tunnels(Move::Direction dir) const {
+      return tunnels_[static_cast<int>(dir) / 2];
+    }
+
+    // Room holding every target which can only be entered through a single
+    // square. Its targets are filled in a fixed order.
+    struct GoalRoom {
+      BoardSquare entrance;
+      // Direction of the push from the entrance into the room.
+      Move::Direction direction;
+      BitBoard squares;
+      // Targets in filling order, and the pushes which bring a box from the
+      // entrance to each of them while the earlier ones hold boxes.
+      std::vector<BoardSquare> slots;
+      std::vector<std::vector<Move>> pushes;
+    };
+
+    // Goal room of the level, without slots if there is none.
+    const GoalRoom& goal_room() const { return goal_room_; }
+
+    // Move generation specialized for the size of the level.
+    const BoardKernels& kernels() const { return *kernels_; }
+
+    // All squares of `empty` connected to `seed` through `empty`, and the
+    // squares next to `region`. Both only touch the rows of the level.
+    BitBoard FloodFilled(const BitBoard& seed, const BitBoard& empty) const;
+    BitBoard Neighbours(const BitBoard& region) const;
+
+    // Transforms which map walls and targets onto themselves, the identity
+    // first.
+    const std::vector<Transform>& symmetries() const { return symmetries_; }
+
+    BoardSquare Apply(Transform transform, BoardSquare square) const;
+    Move Apply(Transform transform, Move move) const;
+
+    bool operator==(const Level& other) const {
+      return walls_ == other.walls_ && targets_ == other.targets_;
+    }
+
+  private:
+    int rows_;
+    int cols_;
+    const BoardKernels* kernels_;
+    BitBoard walls_;
+    BitBoard targets_;
+    BitBoard inside_;
+    BitBoard dead_squares_;
+    std::vector<Transform> symmetries_;
+    std::vector<BoardSquare> target_squares_;
+    std::vector<std::uint16_t> push_distances_;
+    // Indexed by the direction's axis: vertical, then horizontal.
+    BitBoard tunnels_[2];
+    GoalRoom goal_room_;
+
+    void FindGoalRoom(const BitBoard& inside, BoardSquare player);
+  };
+
   class SokoBoard {
   public:
 
@@ -16,34 +141,156 @@ namespace pzero {
 
     void Clear();
 
+    // Restores the board to its state before a DoMove.
+    struct UndoInfo {
+      BoardSquare player;
+      BoardSquare last_push;
+      bool pushed;
+    };
+
+    // Whether the move can be played in this position.
+    bool IsLegal(Move move) const;
+
+    // Plays a move after checking it is legal, throws on illegal moves.
     void ApplyMove(Move move);
 
-    bool IsEnd() const;
+    // Plays a move known to be legal, e.g. one from GenerateLegalMoves. No
+    // validation is done outside of debug builds.
+    UndoInfo DoMove(Move move);
+
+    // Takes back `move`, which must be the last one played with DoMove.
+    void UndoMove(Move move, const UndoInfo& undo);
+
+    bool IsEnd() const { return boxes_off_target_ == 0; }
+
+    // Number of boxes not standing on a target, kept up to date by moves.
+    int BoxesOffTarget() const { return boxes_off_target_; }
+
+    // Whether some box is on a dead square or two boxes block each other
+    // along a wall.
     bool IsStuck() const;
 
+    // Whether the box moved by the last push froze together with the boxes
+    // blocking it while one of them is off target.
+    bool IsFreezeDeadlock() const;
+
+    // Whether the 3x3 window around the last pushed box matches a deadlock
+    // pattern from the generated table.
+    bool IsPatternDeadlock() const;
+
+    // Admissible estimate of the pushes left: the push distances of the
+    // cheapest assignment of boxes to distinct targets, ignoring the other
+    // boxes. -1 when no such assignment exists, which is a deadlock.
+    // Computed on first use and then updated incrementally by every push.
+    int LowerBound() const;
+
+    // Forgets the matching behind LowerBound(), so that boards which are
+    // only looked at don't keep it up to date on every move.
+    void DropLowerBound() { matching_.reset(); }
+
     MoveList GenerateLegalMoves() const;
 
+    // One push move per pushable box and direction.
+    MoveList GenerateLegalPushes() const;
+
+    // Pushes where the pushes forced afterwards are made part of the move.
+    // A box the player follows into a tunnel goes through it to the exit,
+    // and a box pushed into the entrance of the goal room goes on to the
+    // next free slot.
+    MoveList GenerateLegalMacroPushes() const;
+
+    MoveList GenerateLegalMoves(MoveMode mode) const {
+      switch (mode) {
+      case MoveMode::Push:
+        return GenerateLegalPushes();
+      case MoveMode::Macro:
+        return GenerateLegalMacroPushes();
+      default:
+        return GenerateLegalMoves();
+      }
+    }
+
+    // Player steps which make up the move: the walk to the box followed by
+    // the push for push moves, the move itself for steps.
+    std::vector<Move> ExpandMove(Move move) const;
+
+    // Squares the player can walk to without pushing any box.
+    BitBoard PlayerReachable() const;
+
+    // Boxes which can be pushed from the player's reachable region, indexed
+    // by push direction.
+    std::array<BitBoard, 4> GeneratePushes() const;
+    std::array<BitBoard, 4> GeneratePushes(const BitBoard& reachable) const;
+
+    // Zobrist key of the box and player placement.
+    std::uint64_t Hash() const { return hash_; }
+
+    // Key which only depends on the player's reachable region, not on the
+    // exact square the player stands on.
+    std::uint64_t NormalizedHash(const BitBoard& reachable) const;
+
+    // Same level and player with a different set of boxes.
+    SokoBoard WithBoxes(const BitBoard& boxes) const;
+
+    struct CanonicalKey {
+      std::uint64_t hash;
+      // Symmetry of the level which maps this board to the image the hash
+      // was computed from.
+      Transform transform;
+    };
+
+    // Smallest key over all images of the position under the symmetries of
+    // the level. Symmetric positions share the key.
+    CanonicalKey Canonical() const;
+
+    // Image of the board under one of the level's symmetries.
+    SokoBoard Transformed(Transform transform) const;
+
     bool operator==(const SokoBoard& other) const {
-      return (walls_ == other.walls_) &&
-      (targets_ == other.targets_) && 
+      return (hash_ == other.hash_) &&
       (boxes_ == other.boxes_) && 
-      (char_ == other.char_);
+      (char_ == other.char_) &&
+      (level_ == other.level_ || *level_ == *other.level_);
     }
 
     bool operator!=(const SokoBoard& other) const { return !operator==(other); }
 
     std::string DebugString() const;
 
-    BitBoard walls() const { return walls_; }
-    BitBoard targets() const { return targets_; }
-    BitBoard boxes() const { return boxes_; }
+    const Level& level() const { return *level_; }
+    const BitBoard& walls() const { return level_->walls(); }
+    const BitBoard& targets() const { return level_->targets(); }
+    const BitBoard& boxes() const { return boxes_; }
     BoardSquare king() const { return char_; }
 
+    const BitBoard& dead_squares() const { return level_->dead_squares(); }
+
   private:
-    BitBoard walls_;
-    BitBoard targets_;
+    std::uint64_t ComputeHash() const;
+    void MoveBox(BoardSquare from, BoardSquare to);
+    void MovePlayer(BoardSquare to);
+
+    // Whether a box pushed onto `box` in direction `dir` is carried on by a
+    // macro, before or after the push is played.
+    bool EntersGoalRoom(BoardSquare box, Move::Direction dir) const;
+    bool ContinuesTunnel(BoardSquare box, Move::Direction dir) const;
+    // Plays the pushes a macro makes after its first one, adding them to
+    // `pushes` if given.
+    void ContinueMacro(Move::Direction dir, std::vector<Move>* pushes);
+
+    const Level* level_ = nullptr;
     BitBoard boxes_;
     BoardSquare char_;
+    std::uint64_t hash_ = 0;
+    int boxes_off_target_ = 0;
+
+    // Where the last move left a pushed box, if it pushed one.
+    BoardSquare last_push_;
+    bool pushed_ = false;
+
+    // Box to target assignment behind LowerBound(), shared between copies
+    // until a box moves.
+    mutable std::shared_ptr<BoxMatching> matching_;
   };
   
 } // namespace pzero
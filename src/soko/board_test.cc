@@ -1,20 +1,28 @@
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include "src/perft/perft.h"
 #include "src/soko/bitboard.h"
 #include "src/soko/board.h"
+#include "src/soko/corral.h"
+#include "src/soko/deadlocks.h"
+#include "src/soko/levels.h"
+#include "src/soko/position.h"
+#include "src/utils/exception.h"
 
 namespace pzero {
   
   TEST(BoardSquare, BoardSquare) {
     {
-      auto x = BoardSquare(19);
+      auto x = BoardSquare(63);
       EXPECT_EQ(x.row(), 0);
-      EXPECT_EQ(x.col(), 19);
+      EXPECT_EQ(x.col(), 63);
     }
 
     {
-      auto x = BoardSquare(20);
+      auto x = BoardSquare(64);
       EXPECT_EQ(x.row(), 1);
       EXPECT_EQ(x.col(), 0);
     }
@@ -27,6 +35,78 @@ namespace pzero {
   }
 
 
+  TEST(BitBoard, SetResetCount) {
+    BitBoard board;
+    EXPECT_TRUE(board.empty());
+
+    board.set(0, 0);
+    board.set(3, 19);
+    board.set(19, 19);
+    EXPECT_FALSE(board.empty());
+    EXPECT_EQ(board.count(), 3);
+    EXPECT_TRUE(board.get(3, 19));
+    EXPECT_FALSE(board.get(3, 18));
+
+    board.reset(3, 19);
+    EXPECT_EQ(board.count(), 2);
+    EXPECT_FALSE(board.get(3, 19));
+  }
+
+  TEST(BitBoard, Operators) {
+    BitBoard a;
+    BitBoard b;
+    a.set(1, 1);
+    a.set(10, 10);
+    b.set(10, 10);
+    b.set(15, 3);
+
+    EXPECT_TRUE(a.intersects(b));
+    EXPECT_NE(a, b);
+    EXPECT_EQ((a & b).count(), 1);
+    EXPECT_EQ((a | b).count(), 3);
+    EXPECT_EQ((a ^ b).count(), 2);
+    EXPECT_EQ((a - b).count(), 1);
+    EXPECT_TRUE((a - b).get(1, 1));
+    EXPECT_FALSE((a - b).intersects(b));
+
+    BitBoard c = a;
+    EXPECT_EQ(a, c);
+    c |= b;
+    EXPECT_EQ(c, a | b);
+  }
+
+  TEST(BitBoard, Shifted) {
+    BitBoard board;
+    board.set(5, 5);
+
+    EXPECT_TRUE(board.Shifted(Move::Direction::Up).get(6, 5));
+    EXPECT_TRUE(board.Shifted(Move::Direction::Down).get(4, 5));
+    EXPECT_TRUE(board.Shifted(Move::Direction::Left).get(5, 4));
+    EXPECT_TRUE(board.Shifted(Move::Direction::Right).get(5, 6));
+
+    // Squares never wrap around the board edges.
+    BitBoard edges;
+    edges.set(7, 0);
+    edges.set(8, kMaxBoardSize - 1);
+    edges.set(kMaxBoardSize - 1, 3);
+    edges.set(0, 4);
+    EXPECT_EQ(edges.Shifted(Move::Direction::Left).count(), 3);
+    EXPECT_EQ(edges.Shifted(Move::Direction::Right).count(), 3);
+    EXPECT_EQ(edges.Shifted(Move::Direction::Up).count(), 3);
+    EXPECT_EQ(edges.Shifted(Move::Direction::Down).count(), 3);
+  }
+
+  TEST(BitBoard, Iterate) {
+    BitBoard board;
+    std::vector<int> expected = {0, 63, 64, 200, kNumSquares - 1};
+    for (int sq : expected) board.set(static_cast<std::uint16_t>(sq));
+
+    std::vector<int> squares;
+    for (auto sq : board) squares.push_back(sq.as_int());
+    EXPECT_EQ(squares, expected);
+    EXPECT_EQ(board.first().as_int(), 0);
+  }
+
   TEST(SokoBoard, LegalMovesStartingPos) {
     SokoBoard board;
     board.SetFromFen(SokoBoard::kStartposFen);
@@ -89,6 +169,137 @@ namespace pzero {
     
   }
 
+  TEST(SokoBoard, PlayerReachableAndPushes) {
+    const char* fen =
+      "#####\n"
+      "#@$ #\n"
+      "# $.#\n"
+      "#  .#\n"
+      "#####\n";
+
+    SokoBoard board(fen);
+
+    BitBoard expected;
+    for (auto sq : {BoardSquare(3, 1), BoardSquare(2, 1), BoardSquare(1, 1),
+                    BoardSquare(1, 2), BoardSquare(1, 3), BoardSquare(2, 3),
+                    BoardSquare(3, 3)}) {
+      expected.set(sq);
+    }
+    EXPECT_EQ(board.PlayerReachable(), expected);
+
+    BitBoard both_boxes;
+    both_boxes.set(3, 2);
+    both_boxes.set(2, 2);
+
+    auto pushes = board.GeneratePushes();
+    EXPECT_EQ(pushes[static_cast<int>(Move::Direction::Right)], both_boxes);
+    EXPECT_EQ(pushes[static_cast<int>(Move::Direction::Left)], both_boxes);
+    EXPECT_TRUE(pushes[static_cast<int>(Move::Direction::Up)].empty());
+    EXPECT_TRUE(pushes[static_cast<int>(Move::Direction::Down)].empty());
+  }
+
+  TEST(Move, PushString) {
+    Move push(BoardSquare(7, 4), Move::Direction::Left);
+    EXPECT_TRUE(push.is_push());
+    EXPECT_EQ(push.as_string(), "left@7,4");
+    EXPECT_EQ(Move(push.as_string()), push);
+    EXPECT_EQ(push.box(), BoardSquare(7, 4));
+    EXPECT_EQ(push.direction(), Move::Direction::Left);
+
+    EXPECT_FALSE(Move("up").is_push());
+    EXPECT_NE(Move("up").as_packed_int(), Move("up@1,1").as_packed_int());
+  }
+
+  TEST(SokoBoard, PushMoves) {
+    SokoBoard board(SokoBoard::kStartposFen);
+
+    auto pushes = board.GenerateLegalPushes();
+    MoveList expected = {"up@3,5", "left@3,5", "left@6,7"};
+    EXPECT_EQ(pushes, expected);
+
+    // The walk to the box is spelled out as single steps.
+    std::vector<Move> steps = {"up", "left", "left", "left", "left", "left", "left"};
+    EXPECT_EQ(board.ExpandMove("left@3,5"), steps);
+
+    SokoBoard pushed = board;
+    pushed.ApplyMove("left@3,5");
+    SokoBoard stepped = board;
+    PlayMoves(stepped, "up left left left left left left");
+    EXPECT_EQ(pushed, stepped);
+
+    EXPECT_THROW(board.ApplyMove("down@3,5"), Exception);
+  }
+
+  TEST(SokoBoard, DoUndoMove) {
+    const SokoBoard start(SokoBoard::kStartposFen);
+    EXPECT_TRUE(start.IsLegal("up"));
+    EXPECT_FALSE(start.IsLegal("down"));
+    EXPECT_TRUE(start.IsLegal("left@3,5"));
+    EXPECT_FALSE(start.IsLegal("right@3,5"));
+
+    SokoBoard board = start;
+    std::vector<std::pair<Move, SokoBoard::UndoInfo>> played;
+    for (const Move move : {Move("up"), Move("left@3,5"), Move("down"),
+                            Move("up"), Move("left")}) {
+      played.emplace_back(move, board.DoMove(move));
+    }
+    EXPECT_EQ(board.BoxesOffTarget(), 6);
+    EXPECT_NE(board, start);
+
+    while (!played.empty()) {
+      board.UndoMove(played.back().first, played.back().second);
+      played.pop_back();
+    }
+    EXPECT_EQ(board, start);
+    EXPECT_EQ(board.Hash(), start.Hash());
+    EXPECT_EQ(board.king(), start.king());
+    EXPECT_EQ(board.PlayerReachable(), start.PlayerReachable());
+
+    EXPECT_THROW(board.ApplyMove("down"), Exception);
+  }
+
+  TEST(SokoBoard, PlayerReachableStartingPos) {
+    SokoBoard board(SokoBoard::kStartposFen);
+
+    // Plain breadth-first search over single steps for comparison.
+    BitBoard visited;
+    std::vector<BoardSquare> queue = {board.king()};
+    visited.set(board.king());
+    const int deltas[] = {kMaxBoardSize, -kMaxBoardSize, -1, 1};
+    for (size_t i = 0; i < queue.size(); i++) {
+      for (int delta : deltas) {
+        BoardSquare next(queue[i].as_int() + delta);
+        if (visited.get(next) || board.walls().get(next) ||
+            board.boxes().get(next)) {
+          continue;
+        }
+        visited.set(next);
+        queue.push_back(next);
+      }
+    }
+
+    EXPECT_EQ(board.PlayerReachable(), visited);
+    EXPECT_EQ(board.PlayerReachable().count(), static_cast<int>(queue.size()));
+  }
+
+  TEST(SokoBoard, Hash) {
+    SokoBoard board(SokoBoard::kStartposFen);
+
+    SokoBoard stepped = board;
+    PlayMoves(stepped, "up left left left left left left");
+    EXPECT_NE(stepped.Hash(), board.Hash());
+    EXPECT_EQ(stepped.Hash(), SokoBoard(stepped.DebugString()).Hash());
+
+    SokoBoard pushed = board;
+    pushed.ApplyMove("left@3,5");
+    EXPECT_EQ(pushed.Hash(), stepped.Hash());
+
+    // Walking back and forth restores the key.
+    SokoBoard walked = board;
+    PlayMoves(walked, "up left right down");
+    EXPECT_EQ(walked.Hash(), board.Hash());
+  }
+
   TEST(SokoBoard, IsEndBoard) {
     SokoBoard board;
     board.SetFromFen(SokoBoard::kStartposFen);
@@ -113,11 +324,14 @@ namespace pzero {
 
     EXPECT_EQ(board.IsEnd(), false);
     EXPECT_EQ(board2.IsEnd(), false);
+    EXPECT_EQ(board.BoxesOffTarget(), 6);
+    EXPECT_EQ(board2.BoxesOffTarget(), 1);
 
     SokoBoard board3 = board2;
     PlayMoves(board3, "right");
 
     EXPECT_EQ(board3.IsEnd(), true);
+    EXPECT_EQ(board3.BoxesOffTarget(), 0);
   }
 
   TEST(SokoBoard, IsStuckBoard) {
@@ -164,6 +378,436 @@ namespace pzero {
     EXPECT_EQ(board4.IsStuck(), true);
   }
 
+  TEST(SokoBoard, DeadSquares) {
+    const char* fen =
+      "#######\n"
+      "#  $  #\n"
+      "#   . #\n"
+      "#  @  #\n"
+      "#######\n";
+
+    SokoBoard board(fen);
+
+    // Nothing can be pulled away from the walls, except onto the target.
+    BitBoard expected;
+    for (int col = 1; col <= 5; col++) {
+      expected.set(3, col);
+      expected.set(1, col);
+    }
+    expected.set(2, 1);
+    expected.set(2, 5);
+    EXPECT_EQ(board.dead_squares(), expected);
+    EXPECT_TRUE(board.IsStuck());
+
+    SokoBoard start(SokoBoard::kStartposFen);
+    EXPECT_FALSE(start.dead_squares().intersects(start.targets()));
+    EXPECT_FALSE(start.IsStuck());
+
+    // Boards of the same level share its static data, also when set up
+    // again from a fen.
+    SokoBoard next = start;
+    next.ApplyMove("up");
+    EXPECT_EQ(&next.level(), &start.level());
+    EXPECT_EQ(&SokoBoard(SokoBoard::kStartposFen).level(), &start.level());
+    EXPECT_NE(&SokoBoard(next.DebugString()).level(), &start.level());
+  }
+
+  TEST(SokoBoard, FreezeDeadlock) {
+    const char* fen =
+      "########\n"
+      "#      #\n"
+      "# $$   #\n"
+      "# $ $@.#\n"
+      "#   ...#\n"
+      "########\n";
+
+    SokoBoard board(fen);
+    EXPECT_FALSE(board.IsFreezeDeadlock());
+
+    // Closes a 2x2 block of boxes in the middle of the room.
+    SokoBoard frozen = board;
+    PlayMoves(frozen, "left");
+    EXPECT_FALSE(frozen.IsStuck());
+    EXPECT_TRUE(frozen.IsFreezeDeadlock());
+
+    // The freeze only counts when it is caused by the last push.
+    PlayMoves(frozen, "right");
+    EXPECT_FALSE(frozen.IsFreezeDeadlock());
+
+    SokoBoard free = board;
+    PlayMoves(free, "down left up");
+    EXPECT_FALSE(free.IsFreezeDeadlock());
+
+    // Frozen boxes on targets are fine.
+    const char* solved_fen =
+      "#######\n"
+      "#     #\n"
+      "# **  #\n"
+      "# *.$@#\n"
+      "#     #\n"
+      "#######\n";
+    SokoBoard solved(solved_fen);
+    PlayMoves(solved, "left");
+    EXPECT_FALSE(solved.IsFreezeDeadlock());
+  }
+
+  TEST(SokoBoard, PatternDeadlock) {
+    const char* fen =
+      "########\n"
+      "#      #\n"
+      "# $$   #\n"
+      "# $ $@.#\n"
+      "#   ...#\n"
+      "########\n";
+
+    SokoBoard board(fen);
+    EXPECT_FALSE(board.IsPatternDeadlock());
+
+    SokoBoard frozen = board;
+    PlayMoves(frozen, "left");
+    EXPECT_TRUE(frozen.IsPatternDeadlock());
+
+    SokoBoard free = board;
+    PlayMoves(free, "down left up");
+    EXPECT_FALSE(free.IsPatternDeadlock());
+
+    // A lone box can always be pushed away, even onto a target.
+    EXPECT_FALSE(IsDeadlockPattern(0));
+    EXPECT_FALSE(IsDeadlockPattern(1u << kPatternCenterBit));
+  }
+
+  TEST(CorralDetector, CorralDeadlock) {
+    // The only push moves the box into the closed room above, where the
+    // player can never follow it.
+    const char* fen =
+      "#######\n"
+      "#.   .#\n"
+      "##$####\n"
+      "#  @  #\n"
+      "#######\n";
+
+    SokoBoard board(fen);
+    EXPECT_FALSE(board.IsStuck());
+
+    CorralDetector detector;
+    EXPECT_TRUE(detector.IsDeadlock(board));
+    // Served from the cache the second time.
+    EXPECT_TRUE(detector.IsDeadlock(board));
+
+    EXPECT_FALSE(detector.IsDeadlock(SokoBoard(SokoBoard::kStartposFen)));
+
+    // Only a game judged with the detector is over.
+    PositionHistory history;
+    history.Reset(board);
+    EXPECT_EQ(history.ComputeGameResult(MoveMode::Step),
+              GameResult::UNDECIDED);
+    EXPECT_EQ(history.ComputeGameResult(MoveMode::Step, &detector),
+              GameResult::LOSE);
+  }
+
+  TEST(LevelCollection, IndexAndLoad) {
+    const std::string filename = "levels_test.xsb";
+    {
+      std::ofstream file(filename);
+      file << "Title: Collection\n"
+           << "\n"
+           << "; 1\n"
+           << "#####\r\n"
+           << "#@$.#\r\n"
+           << "#####\r\n"
+           << "Title: Two\n"
+           << "\n"
+           << "; 2\n"
+           << "----#####\n"
+           << "#####_+$#\n"
+           << "#___$_$.#\n"
+           << "#########";
+    }
+
+    LevelCollection levels(filename);
+    ASSERT_EQ(levels.size(), 2);
+
+    SokoBoard first(levels.GetFen(0));
+    EXPECT_EQ(first.BoxesOffTarget(), 1);
+    EXPECT_EQ(first.king(), BoardSquare(1, 1));
+
+    SokoBoard second(levels.GetFen(1));
+    EXPECT_EQ(second.BoxesOffTarget(), 3);
+    EXPECT_EQ(second.targets().count(), 2);
+    EXPECT_EQ(second.king(), BoardSquare(2, 6));
+    EXPECT_EQ(second.walls().count(), 22);
+
+    EXPECT_THROW(levels.GetFen(2), Exception);
+    std::remove(filename.c_str());
+  }
+
+  // Empty rectangular room with the player in the top left corner, a box
+  // next to it and a target in the top right corner.
+  std::string MakeRoomFen(int rows, int cols) {
+    std::string fen(cols, '#');
+    fen += '\n';
+    for (int row = 1; row < rows - 1; row++) {
+      std::string line = "#" + std::string(cols - 2, ' ') + "#\n";
+      if (row == 1) {
+        line.replace(1, 3, " @$");
+        line[cols - 2] = '.';
+      }
+      fen += line;
+    }
+    return fen + std::string(cols, '#') + '\n';
+  }
+
+  TEST(SokoBoard, LargeLevel) {
+    const std::string fen = MakeRoomFen(40, 64);
+    SokoBoard board(fen);
+    EXPECT_EQ(board.level().rows(), 40);
+    EXPECT_EQ(board.level().cols(), 64);
+    EXPECT_EQ(board.DebugString(), fen);
+    EXPECT_EQ(board.king(), BoardSquare(38, 2));
+    EXPECT_EQ(board.PlayerReachable().count(), 38 * 62 - 1);
+    EXPECT_FALSE(board.IsStuck());
+
+    // Push the box along the top wall towards the target.
+    board.ApplyMove("right@38,3");
+    EXPECT_EQ(board.boxes().first(), BoardSquare(38, 4));
+    EXPECT_TRUE(board.IsLegal(Move(BoardSquare(38, 4), Move::Direction::Right)));
+    EXPECT_FALSE(board.IsLegal(Move(BoardSquare(38, 4), Move::Direction::Down)));
+
+    EXPECT_THROW(SokoBoard(MakeRoomFen(65, 10)), Exception);
+    EXPECT_THROW(SokoBoard(MakeRoomFen(10, 65)), Exception);
+  }
+
+  TEST(SokoBoard, MaxBoxes) {
+    // Boxes on every other square of the inner rows, each free to be pushed
+    // in all four directions. The room's own box against the top wall only
+    // goes left or right.
+    auto make_fen = [](int boxes) {
+      std::string fen = MakeRoomFen(40, 64);
+      for (int i = 0; i < boxes; i++) {
+        fen[(4 + i / 30 * 2) * 65 + 2 + i % 30 * 2] = '$';
+        fen[(4 + i / 30 * 2) * 65 + 3 + i % 30 * 2] = '.';
+      }
+      return fen;
+    };
+    const SokoBoard board(make_fen(kMaxBoxes - 1));
+    EXPECT_EQ(board.boxes().count(), kMaxBoxes);
+    EXPECT_EQ(board.GenerateLegalMoves(MoveMode::Push).size(),
+              static_cast<size_t>(kMaxMoves - 2));
+    EXPECT_THROW(SokoBoard(make_fen(kMaxBoxes)), Exception);
+  }
+
+  TEST(SokoBoard, KernelsMatchFullBoard) {
+    // One level for each specialization, checked against full size boards.
+    for (int rows : {6, 12, 24, 48}) {
+      SokoBoard board(MakeRoomFen(rows, 10));
+      BitBoard player;
+      player.set(board.king());
+      const BitBoard empty = ~(board.walls() | board.boxes());
+      const BitBoard reachable = player.FloodFilled(empty);
+      EXPECT_EQ(board.PlayerReachable(), reachable);
+      EXPECT_EQ(board.GeneratePushes()[static_cast<int>(Move::Direction::Right)],
+                board.boxes());
+      EXPECT_TRUE(board.GeneratePushes()[static_cast<int>(Move::Direction::Up)].empty());
+      EXPECT_FALSE(board.IsStuck());
+
+      EXPECT_EQ(board.level().inside(), player.FloodFilled(~board.walls()));
+      EXPECT_EQ(board.level().FloodFilled(player, empty), reachable);
+      const BitBoard& boxes = board.boxes();
+      EXPECT_EQ(board.level().Neighbours(boxes),
+                boxes.Shifted(Move::Direction::Up) |
+                boxes.Shifted(Move::Direction::Down) |
+                boxes.Shifted(Move::Direction::Left) |
+                boxes.Shifted(Move::Direction::Right));
+
+      // The player walks around the box to push it into the corner.
+      const Move push(BoardSquare(rows - 2, 3), Move::Direction::Left);
+      EXPECT_EQ(board.ExpandMove(push),
+                std::vector<Move>({"down", "right", "right", "up", "left"}));
+      board.ApplyMove(push);
+      EXPECT_FALSE(board.IsFreezeDeadlock());
+      board.ApplyMove(Move(BoardSquare(rows - 2, 2), Move::Direction::Left));
+      EXPECT_TRUE(board.IsFreezeDeadlock());
+    }
+  }
+
+  TEST(SokoBoard, Canonical) {
+    const std::string fen =
+      "#######\n"
+      "#.   .#\n"
+      "#     #\n"
+      "# $@$ #\n"
+      "#     #\n"
+      "#     #\n"
+      "#######\n";
+    SokoBoard left(fen);
+    EXPECT_EQ(left.level().symmetries(),
+              std::vector<Transform>({kIdentity, kFlipCols}));
+    EXPECT_EQ(left.Canonical().transform, kIdentity);
+    SokoBoard right = left;
+
+    left.ApplyMove("up@3,2");
+    right.ApplyMove("up@3,4");
+    EXPECT_NE(left.Hash(), right.Hash());
+    const auto left_key = left.Canonical();
+    const auto right_key = right.Canonical();
+    EXPECT_EQ(left_key.hash, right_key.hash);
+    EXPECT_NE(left_key.transform, right_key.transform);
+    EXPECT_EQ(left.Transformed(left_key.transform).Hash(), left_key.hash);
+    EXPECT_EQ(left.Transformed(kFlipCols).Hash(), right.Hash());
+
+    const Move move = left.level().Apply(kFlipCols, Move("up@4,2"));
+    EXPECT_EQ(move, Move("up@4,4"));
+    EXPECT_EQ(left.level().Apply(Inverse(kFlipCols), move), Move("up@4,2"));
+    const Move macro = left.level().Apply(kFlipCols, Move("up@4,2+"));
+    EXPECT_EQ(macro, Move("up@4,4+"));
+    EXPECT_EQ(left.level().Apply(Inverse(kFlipCols), macro), Move("up@4,2+"));
+    EXPECT_EQ(Inverse(kRotateLeft), kRotateRight);
+  }
+
+  TEST(SokoBoard, LowerBound) {
+    SokoBoard board(
+      "######\n"
+      "#@$ .#\n"
+      "######\n");
+    EXPECT_EQ(board.LowerBound(), 2);
+    board.ApplyMove("right@1,2");
+    EXPECT_EQ(board.LowerBound(), 1);
+
+    // Both boxes can only slide along the bottom wall to the same target.
+    SokoBoard unmatched(
+      "#######\n"
+      "#.    #\n"
+      "#  @  #\n"
+      "#     #\n"
+      "#.$ $ #\n"
+      "#######\n");
+    EXPECT_FALSE(unmatched.IsStuck());
+    EXPECT_EQ(unmatched.LowerBound(), -1);
+
+    // Incremental updates agree with matching from scratch, also when moves
+    // are taken back.
+    SokoBoard startpos(SokoBoard::kStartposFen);
+    const int initial = startpos.LowerBound();
+    EXPECT_GT(initial, 0);
+    std::vector<std::pair<Move, SokoBoard::UndoInfo>> played;
+    for (int i = 0; i < 6; i++) {
+      const auto pushes = startpos.GenerateLegalPushes();
+      ASSERT_GT(pushes.size(), 0u);
+      const Move move = *(pushes.begin() + i % pushes.size());
+      played.emplace_back(move, startpos.DoMove(move));
+      EXPECT_EQ(startpos.LowerBound(),
+                SokoBoard(startpos.DebugString()).LowerBound());
+    }
+    while (!played.empty()) {
+      startpos.UndoMove(played.back().first, played.back().second);
+      played.pop_back();
+    }
+    EXPECT_EQ(startpos.LowerBound(), initial);
+  }
+
+  TEST(SokoBoard, TunnelMacro) {
+    SokoBoard board(
+      "#########\n"
+      "#@$    .#\n"
+      "#########\n");
+    const SokoBoard before = board;
+    const Move macro("right@1,2+");
+    EXPECT_TRUE(macro.is_macro());
+    EXPECT_EQ(macro.as_string(), "right@1,2+");
+    EXPECT_EQ(macro.box(), BoardSquare(1, 2));
+    EXPECT_EQ(board.GenerateLegalMacroPushes(), MoveList({macro}));
+    EXPECT_EQ(board.ExpandMove(macro), std::vector<Move>(5, "right"));
+
+    // The box goes through the tunnel up to the target in one move.
+    const auto undo = board.DoMove(macro);
+    EXPECT_TRUE(board.IsEnd());
+    EXPECT_EQ(board.king(), BoardSquare(1, 6));
+    board.UndoMove(macro, undo);
+    EXPECT_EQ(board, before);
+  }
+
+  TEST(SokoBoard, GoalRoomMacro) {
+    SokoBoard board(
+      "########\n"
+      "#   ####\n"
+      "# @$ ..#\n"
+      "#   ####\n"
+      "########\n");
+    const auto& room = board.level().goal_room();
+    EXPECT_EQ(room.entrance, BoardSquare(2, 4));
+    EXPECT_EQ(room.direction, Move::Direction::Right);
+    EXPECT_EQ(room.slots,
+              std::vector<BoardSquare>({BoardSquare(2, 6), BoardSquare(2, 5)}));
+
+    // Pushing the box into the entrance parks it on the deepest slot.
+    const Move macro("right@2,3+");
+    EXPECT_EQ(board.GenerateLegalMacroPushes(),
+              MoveList({"up@2,3", "down@2,3", macro}));
+    EXPECT_EQ(board.ExpandMove(macro), std::vector<Move>(3, "right"));
+    board.DoMove(macro);
+    EXPECT_TRUE(board.boxes().get(BoardSquare(2, 6)));
+    EXPECT_EQ(board.king(), BoardSquare(2, 5));
+  }
+
+  TEST(SokoBoard, Perft) {
+    SokoBoard board(SokoBoard::kStartposFen);
+    const SokoBoard before = board;
+    EXPECT_EQ(Perft(&board, 1, MoveMode::Step, false),
+              board.GenerateLegalMoves().size());
+    EXPECT_EQ(Perft(&board, 14, MoveMode::Step, false), 172994u);
+    EXPECT_EQ(Perft(&board, 4, MoveMode::Push, false), 187u);
+    EXPECT_EQ(Perft(&board, 4, MoveMode::Macro, false), 184u);
+    EXPECT_EQ(Perft(&board, 6, MoveMode::Push, true), 360u);
+    EXPECT_EQ(board, before);
+  }
+
+  TEST(PositionHistory, Repetitions) {
+    PositionHistory history;
+    history.Reset(SokoBoard(SokoBoard::kStartposFen));
+    for (size_t i = 0; i < 100; i++) {
+      history.Append(i % 2 ? "down" : "up");
+      EXPECT_EQ(history.GetLastRepetitions(), static_cast<int>(i + 1) / 2);
+    }
+
+    // Trimming takes the dropped positions back out of the counts.
+    history.Trim(3);
+    EXPECT_EQ(history.GetLastRepetitions(), 1);
+    history.Append("up");
+    EXPECT_EQ(history.GetLastRepetitions(), 1);
+    history.Append("right");
+    EXPECT_EQ(history.GetLastRepetitions(), 0);
+    history.Append("left");
+    EXPECT_EQ(history.GetLastRepetitions(), 2);
+
+    // Earlier boards are rebuilt from the last one.
+    EXPECT_EQ(history.GetBoardAt(0), SokoBoard(SokoBoard::kStartposFen));
+    EXPECT_EQ(history.GetBoardAt(4).Hash(), history.GetHashAt(4));
+    EXPECT_EQ(history.GetMoveAt(5), Move("left"));
+  }
+
+  TEST(PositionHistory, PushDeadEnd) {
+    // The player walks along the bottom row but the only box it reaches is
+    // held in the gap of the wall by the one above it.
+    SokoBoard board(
+      "#######\n"
+      "#.   .#\n"
+      "#  $  #\n"
+      "###$###\n"
+      "#  @  #\n"
+      "#######\n");
+    EXPECT_FALSE(board.IsStuck());
+    EXPECT_FALSE(board.IsFreezeDeadlock());
+    EXPECT_TRUE(board.GenerateLegalMoves(MoveMode::Push).empty());
+    EXPECT_FALSE(board.GenerateLegalMoves(MoveMode::Step).empty());
+
+    PositionHistory history;
+    history.Reset(board);
+    EXPECT_EQ(history.ComputeGameResult(MoveMode::Push), GameResult::LOSE);
+    EXPECT_EQ(history.ComputeGameResult(MoveMode::Macro), GameResult::LOSE);
+    EXPECT_EQ(history.ComputeGameResult(MoveMode::Step),
+              GameResult::UNDECIDED);
+  }
+
   TEST(SokoBoard, IsStuckBoard2) {
     const char* StuckPosFen =
       "    #####\n"
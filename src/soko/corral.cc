@@ -0,0 +1,79 @@
+#include "soko/corral.h"
+
+#include <unordered_set>
+#include <vector>
+
+namespace pzero {
+
+  CorralDetector::CorralDetector(int cache_bits, int search_limit)
+    : search_limit_(search_limit),
+      cache_mask_((1ull << cache_bits) - 1),
+      cache_(new std::atomic<std::uint64_t>[1ull << cache_bits]) {
+    for (std::uint64_t i = 0; i <= cache_mask_; i++) {
+      cache_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  bool CorralDetector::IsDeadlock(const SokoBoard& board) {
+    const BitBoard reachable = board.PlayerReachable();
+    const std::uint64_t key = board.NormalizedHash(reachable) | 1;
+
+    auto& entry = cache_[key & cache_mask_];
+    const std::uint64_t cached = entry.load(std::memory_order_relaxed);
+    if ((cached | 1) == key) return cached & 1;
+
+    const Level& level = board.level();
+    BitBoard fenced = level.inside() - board.boxes() - reachable;
+
+    bool result = false;
+    while (!fenced.empty() && !result) {
+      BitBoard seed;
+      seed.set(fenced.first());
+      const BitBoard corral = level.FloodFilled(seed, fenced);
+      fenced -= corral;
+      result = IsCorralDeadlock(board, corral);
+    }
+
+    entry.store(result ? key : key & ~1ull, std::memory_order_relaxed);
+    return result;
+  }
+
+  bool CorralDetector::IsCorralDeadlock(const SokoBoard& board,
+                                        const BitBoard& corral) const {
+    const BitBoard boxes = board.boxes() & board.level().Neighbours(corral);
+
+    // Nothing to prove when the fence is already done and no target waits
+    // inside.
+    if ((boxes - board.targets()).empty() &&
+        !corral.intersects(board.targets())) {
+      return false;
+    }
+
+    std::vector<SokoBoard> stack = {board.WithBoxes(boxes)};
+    std::unordered_set<std::uint64_t> seen;
+
+    while (!stack.empty()) {
+      const SokoBoard position = stack.back();
+      stack.pop_back();
+
+      const BitBoard reachable = position.PlayerReachable();
+      if (reachable.intersects(corral)) return false;
+      if ((position.boxes() - position.targets()).empty()) return false;
+
+      for (const auto push : position.GenerateLegalPushes()) {
+        SokoBoard next = position;
+        next.DoMove(push);
+        if (next.IsStuck() || next.IsFreezeDeadlock()) continue;
+        if (!seen.insert(next.NormalizedHash(next.PlayerReachable())).second) {
+          continue;
+        }
+        // Too expensive to prove, assume the corral can be solved.
+        if (static_cast<int>(seen.size()) > search_limit_) return false;
+        stack.push_back(next);
+      }
+    }
+
+    return true;
+  }
+
+} // namespace pzero
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "soko/board.h"
+
+namespace pzero {
+
+  // Proves deadlocks caused by corrals: areas fenced in by boxes which the
+  // player can't enter without pushing one of them. The boxes around a
+  // corral are searched on their own with every other box removed. If they
+  // can neither reach targets nor open the corral to the player, the
+  // position is lost.
+  class CorralDetector {
+  public:
+    CorralDetector(int cache_bits = 16, int search_limit = 1000);
+
+    // Whether the position is a proven corral deadlock. Results are cached by
+    // box placement and player region. Thread safe.
+    bool IsDeadlock(const SokoBoard& board);
+
+  private:
+    bool IsCorralDeadlock(const SokoBoard& board, const BitBoard& corral) const;
+
+    const int search_limit_;
+    const std::uint64_t cache_mask_;
+
+    // Entries hold the position key with the lowest bit replaced by the
+    // result, zero means empty.
+    std::unique_ptr<std::atomic<std::uint64_t>[]> cache_;
+  };
+
+} // namespace pzero
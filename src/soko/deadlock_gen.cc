@@ -0,0 +1,99 @@
+// Generates the local deadlock pattern table used by soko/deadlocks.cc.
+//
+// Every 3x3 window around a pushed box is searched on its own. Squares
+// outside the window are assumed to be free floor the player can always
+// reach, and any floor square may hide a target. Only squares holding a box
+// off target are known not to be targets. A window is a deadlock when no
+// sequence of pushes clears boxes off all of those squares, which makes the
+// table sound whatever surrounds the window.
+
+#include <array>
+#include <cstdio>
+#include <vector>
+#include "soko/deadlocks.h"
+
+namespace pzero {
+  namespace {
+
+    constexpr int kWindow = 3;
+    constexpr int kCenter = 4;
+
+    // Window cell of a neighbour index, skipping the center.
+    int CellOf(int neighbour) {
+      return neighbour < kCenter ? neighbour : neighbour + 1;
+    }
+
+    // Returns -1 when the step leaves the window.
+    int Step(int cell, int drow, int dcol) {
+      const int row = cell / kWindow + drow;
+      const int col = cell % kWindow + dcol;
+      if (row < 0 || row >= kWindow || col < 0 || col >= kWindow) return -1;
+      return row * kWindow + col;
+    }
+
+    bool IsDeadlock(std::uint32_t index) {
+      unsigned walls = 0;
+      unsigned boxes = 1 << kCenter;
+      unsigned non_targets = (index >> kPatternCenterBit) & 1 ? 0 : 1 << kCenter;
+      for (int i = 0; i < 8; ++i) {
+        const int cell = CellOf(i);
+        switch ((index >> (i * kPatternCellBits)) & 3) {
+          case kPatternWall: walls |= 1 << cell; break;
+          case kPatternBox: boxes |= 1 << cell; non_targets |= 1 << cell; break;
+          case kPatternBoxOnTarget: boxes |= 1 << cell; break;
+        }
+      }
+
+      static const int kDeltas[4][2] = { {1, 0}, {-1, 0}, {0, -1}, {0, 1} };
+      std::vector<bool> seen(1 << (kWindow * kWindow));
+      std::vector<unsigned> stack = { boxes };
+      seen[boxes] = true;
+      while (!stack.empty()) {
+        const unsigned state = stack.back();
+        stack.pop_back();
+        if (!(state & non_targets)) return false;
+        const unsigned blocked = state | walls;
+        for (int cell = 0; cell < kWindow * kWindow; ++cell) {
+          if (!(state & (1 << cell))) continue;
+          for (const auto& delta : kDeltas) {
+            const int behind = Step(cell, -delta[0], -delta[1]);
+            const int ahead = Step(cell, delta[0], delta[1]);
+            if (behind >= 0 && (blocked & (1 << behind))) continue;
+            if (ahead >= 0 && (blocked & (1 << ahead))) continue;
+            unsigned next = state & ~(1u << cell);
+            if (ahead >= 0) next |= 1 << ahead;
+            if (seen[next]) continue;
+            seen[next] = true;
+            stack.push_back(next);
+          }
+        }
+      }
+      return true;
+    }
+
+  }  // namespace
+}  // namespace pzero
+
+int main(int argc, const char** argv) {
+  using namespace pzero;
+  if (argc != 2) {
+    std::fprintf(stderr, "Usage: %s <output>\n", argv[0]);
+    return 1;
+  }
+
+  std::array<std::uint64_t, kPatternWords> table{};
+  for (std::uint32_t index = 0; index < kNumPatterns; ++index) {
+    if (IsDeadlock(index)) table[index >> 6] |= std::uint64_t(1) << (index & 63);
+  }
+
+  std::FILE* file = std::fopen(argv[1], "w");
+  if (!file) {
+    std::perror(argv[1]);
+    return 1;
+  }
+  for (int i = 0; i < kPatternWords; ++i) {
+    std::fprintf(file, "0x%016llxull,%s", (unsigned long long)table[i],
+                 i % 4 == 3 ? "\n" : " ");
+  }
+  return std::fclose(file) == 0 ? 0 : 1;
+}
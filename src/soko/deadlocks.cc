@@ -0,0 +1,15 @@
+#include "soko/deadlocks.h"
+
+namespace pzero {
+
+  namespace {
+    constexpr std::uint64_t kDeadlockPatterns[kPatternWords] = {
+#include "deadlock_patterns.inc"
+    };
+  }
+
+  bool IsDeadlockPattern(std::uint32_t index) {
+    return (kDeadlockPatterns[index >> 6] >> (index & 63)) & 1;
+  }
+
+} // namespace pzero
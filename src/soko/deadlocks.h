@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+
+namespace pzero {
+
+  // Local deadlock patterns are looked up in the 3x3 window around a pushed
+  // box. Each of the eight neighbours, in row major order starting from the
+  // row below the box, takes two bits of the index. The top bit tells
+  // whether the box itself is on a target.
+  enum PatternCell : std::uint32_t {
+    kPatternFloor = 0,
+    kPatternWall = 1,
+    kPatternBox = 2,
+    kPatternBoxOnTarget = 3
+  };
+
+  constexpr int kPatternCellBits = 2;
+  constexpr int kPatternCenterBit = 8 * kPatternCellBits;
+  constexpr int kNumPatterns = 1 << (kPatternCenterBit + 1);
+  constexpr int kPatternWords = kNumPatterns / 64;
+
+  // Whether the window can never get all of its boxes onto targets. The table
+  // behind it is generated at build time by deadlock_gen.
+  bool IsDeadlockPattern(std::uint32_t index);
+
+} // namespace pzero
@@ -0,0 +1,79 @@
+#include "soko/levels.h"
+
+#include <algorithm>
+#include <cstring>
+#include "soko/board.h"
+#include "utils/exception.h"
+
+namespace pzero {
+
+  namespace {
+    // Whether the line is part of a board rather than a title or comment.
+    bool IsBoardLine(const char* begin, const char* end) {
+      if (end > begin && end[-1] == '\r') --end;
+      bool has_wall = false;
+      for (const char* c = begin; c < end; ++c) {
+        if (!std::strchr("#@+$*.-_ ", *c)) return false;
+        has_wall |= *c == '#';
+      }
+      return has_wall;
+    }
+  } // namespace
+
+  const OptionId LevelCollection::kLevelsId{"levels", "Levels",
+    "Level collection in .xsb/.sok format, without it the built-in start "
+    "position is used. `position level N` loads its N-th level, selfplay "
+    "games go through its levels in order and other modes take --level."};
+
+  const OptionId LevelCollection::kLevelId{"level", "Level",
+    "Level of the collection to use, starting from 1."};
+
+  void LevelCollection::PopulateOptions(OptionsParser* options) {
+    options->Add<StringOption>(kLevelsId) = "";
+  }
+
+  void LevelCollection::PopulateLevelOptions(OptionsParser* options) {
+    PopulateOptions(options);
+    options->Add<IntOption>(kLevelId, 1, 999999) = 1;
+  }
+
+  std::string LevelCollection::GetFen(const OptionsDict& options) {
+    const auto filename = options.Get<std::string>(kLevelsId.GetId());
+    if (filename.empty()) return SokoBoard::kStartposFen;
+    return LevelCollection(filename).GetFen(
+      options.Get<int>(kLevelId.GetId()) - 1);
+  }
+
+  LevelCollection::LevelCollection(const std::string& filename)
+    : file_(filename) {
+    const char* const data = file_.data();
+    const char* const end = data + file_.size();
+
+    bool in_board = false;
+    for (const char* line = data; line < end;) {
+      const char* line_end = std::find(line, end, '\n');
+      const char* next = line_end == end ? end : line_end + 1;
+      if (IsBoardLine(line, line_end)) {
+        if (!in_board) index_.push_back({size_t(line - data), 0});
+        index_.back().length = next - data - index_.back().offset;
+        in_board = true;
+      } else {
+        in_board = false;
+      }
+      line = next;
+    }
+
+    if (index_.empty()) throw Exception("No levels found in " + filename);
+  }
+
+  std::string LevelCollection::GetFen(int index) const {
+    if (index < 0 || index >= size()) {
+      throw Exception("Level " + std::to_string(index + 1) +
+                      " out of range, collection has " +
+                      std::to_string(size()));
+    }
+    const auto& entry = index_[index];
+    return std::string(file_.data() + entry.offset, entry.length);
+  }
+
+} // namespace pzero
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "utils/filesystem.h"
+#include "utils/optionsdict.h"
+#include "utils/optionsparser.h"
+
+namespace pzero {
+
+  // Collection of levels in the common .xsb/.sok text format: boards made of
+  // "#@+$*.-_ " lines, separated by titles, comments or blank lines. The file
+  // is memory mapped and indexed once, loading a level only copies its board.
+  class LevelCollection {
+  public:
+    explicit LevelCollection(const std::string& filename);
+
+    int size() const { return index_.size(); }
+
+    // Board of the level with the given zero based index, in fen form
+    // accepted by SokoBoard::SetFromFen.
+    std::string GetFen(int index) const;
+
+    // Adds --levels, the collection to play instead of the start position.
+    static void PopulateOptions(OptionsParser* options);
+
+    // Adds --levels and --level, which pick a single level to work on.
+    static void PopulateLevelOptions(OptionsParser* options);
+
+    // Board of the level picked by the options, the built-in start
+    // position without a collection.
+    static std::string GetFen(const OptionsDict& options);
+
+    static const OptionId kLevelsId;
+    static const OptionId kLevelId;
+
+  private:
+    struct Entry {
+      size_t offset;
+      size_t length;
+    };
+
+    MappedFile file_;
+    std::vector<Entry> index_;
+  };
+
+} // namespace pzero
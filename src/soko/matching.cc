@@ -0,0 +1,121 @@
+#include "soko/matching.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace pzero {
+
+  namespace {
+    // Cost of an unreachable target. Large enough that no matching using it
+    // is ever preferred over one which doesn't.
+    constexpr std::int64_t kUnreachableCost = 1 << 24;
+    constexpr std::int64_t kInfinity = std::numeric_limits<std::int64_t>::max();
+  }
+
+  BoxMatching::BoxMatching(const Level& level, const BitBoard& boxes)
+    : num_boxes_(boxes.count()) {
+    const int size = std::max<int>(num_boxes_, level.target_squares().size());
+    for (const auto box : boxes) boxes_.push_back(box);
+    boxes_.resize(size);
+    row_match_.assign(size, -1);
+    col_match_.assign(size + 1, -1);
+    row_potential_.assign(size, 0);
+    col_potential_.assign(size + 1, 0);
+    for (int row = 0; row < size; row++) Augment(level, row);
+  }
+
+  std::int64_t BoxMatching::Cost(const Level& level, int row, int col) const {
+    if (row >= num_boxes_) return 0;
+    if (col >= static_cast<int>(level.target_squares().size())) {
+      return kUnreachableCost;
+    }
+    const int distance = level.PushDistance(col, boxes_[row]);
+    return distance == Level::kUnreachable ? kUnreachableCost : distance;
+  }
+
+  void BoxMatching::MoveBox(const Level& level, BoardSquare from,
+                            BoardSquare to) {
+    const auto it = std::find(boxes_.begin(), boxes_.begin() + num_boxes_, from);
+    assert(it != boxes_.begin() + num_boxes_);
+    const int row = it - boxes_.begin();
+    *it = to;
+
+    // Unmatch the row and lower its potential until it is feasible for the
+    // new costs. The other rows keep their tight edges.
+    col_match_[row_match_[row]] = -1;
+    row_match_[row] = -1;
+    std::int64_t potential = kInfinity;
+    for (int col = 0; col < static_cast<int>(boxes_.size()); col++) {
+      potential = std::min(potential,
+                           Cost(level, row, col) - col_potential_[col]);
+    }
+    row_potential_[row] = potential;
+    Augment(level, row);
+  }
+
+  void BoxMatching::Augment(const Level& level, int row) {
+    const int size = boxes_.size();
+    const int root = size;
+    auto& slack = slack_;
+    auto& previous = previous_;
+    auto& visited = visited_;
+    slack.assign(size + 1, kInfinity);
+    previous.assign(size + 1, root);
+    visited.assign(size + 1, false);
+
+    // Grow a tree of tight edges from the row until it reaches a free
+    // column, adjusting potentials whenever no tight edge leaves the tree.
+    col_match_[root] = row;
+    col_potential_[root] = 0;
+    int col = root;
+    do {
+      visited[col] = true;
+      const int current = col_match_[col];
+      std::int64_t delta = kInfinity;
+      int next = root;
+      for (int j = 0; j < size; j++) {
+        if (visited[j]) continue;
+        const std::int64_t reduced = Cost(level, current, j) -
+          row_potential_[current] - col_potential_[j];
+        if (reduced < slack[j]) {
+          slack[j] = reduced;
+          previous[j] = col;
+        }
+        if (slack[j] < delta) {
+          delta = slack[j];
+          next = j;
+        }
+      }
+      for (int j = 0; j <= size; j++) {
+        if (visited[j]) {
+          row_potential_[col_match_[j]] += delta;
+          col_potential_[j] -= delta;
+        } else {
+          slack[j] -= delta;
+        }
+      }
+      col = next;
+    } while (col_match_[col] != -1);
+
+    // Flip the matching along the path back to the root.
+    while (col != root) {
+      const int prev = previous[col];
+      col_match_[col] = col_match_[prev];
+      row_match_[col_match_[col]] = col;
+      col = prev;
+    }
+    col_match_[root] = -1;
+  }
+
+  int BoxMatching::cost(const Level& level) const {
+    std::int64_t total = 0;
+    for (int row = 0; row < num_boxes_; row++) {
+      const std::int64_t cost = Cost(level, row, row_match_[row]);
+      if (cost >= kUnreachableCost) return -1;
+      total += cost;
+    }
+    return total;
+  }
+
+} // namespace pzero
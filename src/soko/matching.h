@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "soko/board.h"
+
+namespace pzero {
+
+  // Minimum cost assignment of boxes to targets, costs being the push
+  // distances of the level. Solved with the Hungarian method; the dual
+  // potentials are kept so that moving a single box only needs one more
+  // augmenting path instead of a full solve.
+  class BoxMatching {
+  public:
+    BoxMatching(const Level& level, const BitBoard& boxes);
+
+    // Rematches after the box on `from` was moved to `to`.
+    void MoveBox(const Level& level, BoardSquare from, BoardSquare to);
+
+    // Total push distance of the matching, -1 when some box can't be
+    // matched to a target it can reach.
+    int cost(const Level& level) const;
+
+  private:
+    std::int64_t Cost(const Level& level, int row, int col) const;
+    void Augment(const Level& level, int row);
+
+    // One row per box, padded with free rows up to the number of targets so
+    // that the assignment is square.
+    int num_boxes_;
+    std::vector<BoardSquare> boxes_;
+    // Column matched to each row and row matched to each column. The extra
+    // last column is used as the root of augmenting paths.
+    std::vector<int> row_match_;
+    std::vector<int> col_match_;
+    std::vector<std::int64_t> row_potential_;
+    std::vector<std::int64_t> col_potential_;
+    // Scratch space of Augment(), kept so that moving a box doesn't
+    // allocate.
+    std::vector<std::int64_t> slack_;
+    std::vector<int> previous_;
+    std::vector<bool> visited_;
+  };
+
+} // namespace pzero
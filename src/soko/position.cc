@@ -1,49 +1,116 @@
 #include "soko/position.h"
+#include <algorithm>
 #include <cassert>
+#include "soko/corral.h"
 
 namespace pzero {
   
-  Position::Position(const Position& parent, Move m) {
-    board_ = parent.board_;
-    board_.ApplyMove(m);
-  }
-
-  Position::Position(const SokoBoard& board)
-    : repetitions_(0) {
-    board_ = board;
-  }
-
-
-  GameResult PositionHistory::ComputeGameResult() const {
-    const auto& board = Last().GetBoard();
+  GameResult PositionHistory::ComputeGameResult(
+    MoveMode mode, CorralDetector* corral_detector) const {
+    const auto& board = Last();
 
     if (board.IsEnd()) return GameResult::WIN;
-    if (Last().GetRepetitions() >= 2) return GameResult::LOSE;
+    if (GetLastRepetitions() >= 2) return GameResult::LOSE;
     if (board.IsStuck()) return GameResult::LOSE;
+    if (board.IsFreezeDeadlock() || board.IsPatternDeadlock() ||
+        board.LowerBound() < 0) {
+      return GameResult::LOSE;
+    }
+    if (corral_detector && corral_detector->IsDeadlock(board)) {
+      return GameResult::LOSE;
+    }
+    if (board.GenerateLegalMoves(mode).empty()) return GameResult::LOSE;
 
     return GameResult::UNDECIDED;
   }  
 
   void PositionHistory::Reset(const SokoBoard& board) {
-    positions_.clear();
-    positions_.emplace_back(board);
+    board_ = board;
+    plies_.clear();
+    plies_.push_back({board.Hash(), Move(), {}, 0});
+    keys_.Clear();
+    keys_.Insert(board.Hash());
   }
 
   void PositionHistory::Append(Move m) {
-    positions_.push_back(Position(Last(), m));
-    positions_.back().SetRepetitions(ComputeLastMoveRepetitions());
+    // The move must be legal, it is not validated.
+    const auto undo = board_.DoMove(m);
+    // Every earlier occurrence of the position adds one repetition. The
+    // 64-bit key stands in for comparing the boards.
+    const int repetitions = keys_.Insert(board_.Hash());
+    plies_.push_back({board_.Hash(), m, undo,
+                      static_cast<std::uint8_t>(std::min(repetitions, 255))});
+  }
+
+  void PositionHistory::Trim(int size) {
+    while (GetLength() > size) {
+      const auto& ply = plies_.back();
+      keys_.Remove(ply.hash);
+      board_.UndoMove(ply.move, ply.undo);
+      plies_.pop_back();
+    }
   }
 
-  int PositionHistory::ComputeLastMoveRepetitions() const {
-    const auto& last = positions_.back();
+  void PositionHistory::UndoMoveAt(int idx, SokoBoard* board) const {
+    assert(idx > 0 && board->Hash() == plies_[idx].hash);
+    board->UndoMove(plies_[idx].move, plies_[idx].undo);
+  }
 
-    for (int idx = positions_.size() - 2; idx >= 0; idx -= 1) {
-      const auto& pos = positions_[idx];
-      if (pos.GetBoard() == last.GetBoard()) {
-        return 1 + pos.GetRepetitions();
+  SokoBoard PositionHistory::GetBoardAt(int idx) const {
+    SokoBoard board = board_;
+    board.DropLowerBound();
+    for (int i = GetLength() - 1; i > idx; i--) UndoMoveAt(i, &board);
+    return board;
+  }
+
+  void PositionKeyCounts::Clear() {
+    entries_.assign(64, {0, -1});
+    used_ = 0;
+  }
+
+  PositionKeyCounts::Entry* PositionKeyCounts::Find(std::uint64_t key) {
+    const size_t mask = entries_.size() - 1;
+    for (size_t idx = key & mask; ; idx = (idx + 1) & mask) {
+      auto& entry = entries_[idx];
+      if (entry.count < 0 || entry.key == key) return &entry;
+    }
+  }
+
+  int PositionKeyCounts::Insert(std::uint64_t key) {
+    auto* entry = Find(key);
+    if (entry->count < 0) {
+      if (4 * (used_ + 1) > 3 * static_cast<int>(entries_.size())) {
+        Grow();
+        entry = Find(key);
       }
+      *entry = {key, 0};
+      used_++;
+    }
+    return entry->count++;
+  }
+
+  void PositionKeyCounts::Remove(std::uint64_t key) {
+    auto* entry = Find(key);
+    assert(entry->count > 0);
+    entry->count--;
+  }
+
+  void PositionKeyCounts::Grow() {
+    // Keys down to a zero count are dropped. The table only doubles when
+    // the live keys would fill more than a quarter of it.
+    std::vector<Entry> old;
+    old.swap(entries_);
+    int live = 0;
+    for (const auto& entry : old) live += entry.count > 0;
+    size_t size = old.size();
+    while (4 * (live + 1) > static_cast<int>(size)) size *= 2;
+    entries_.assign(size, {0, -1});
+    used_ = 0;
+    for (const auto& entry : old) {
+      if (entry.count <= 0) continue;
+      *Find(entry.key) = entry;
+      used_++;
     }
-    return 0;
   }
   
 } // namespace pzero
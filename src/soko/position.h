@@ -1,56 +1,102 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "soko/board.h"
 
 namespace pzero {
-  
-  class Position {
-  public:
-    Position(const Position& parent, Move m);
 
-    Position(const SokoBoard& board);
+  class CorralDetector;
+  
+  enum class GameResult { UNDECIDED, WIN, LOSE };
 
-    int GetRepetitions() const { return repetitions_; }
+  // Multiset of position keys, open addressing with linear probing. Keys
+  // are removed in the reverse order they were added, so a removed key
+  // keeps its slot with a zero count until the table is next rebuilt.
+  class PositionKeyCounts {
+  public:
+    PositionKeyCounts() { Clear(); }
 
-    void SetRepetitions(int repetitions) { repetitions_ = repetitions; }
+    void Clear();
 
+    // Adds the key and returns how many times it was there before.
+    int Insert(std::uint64_t key);
 
-    const SokoBoard& GetBoard() const { return board_; }
+    void Remove(std::uint64_t key);
 
   private:
-    SokoBoard board_;
+    struct Entry {
+      std::uint64_t key;
+      // -1 for slots never used.
+      int count;
+    };
 
-    int repetitions_;    
-  };
+    Entry* Find(std::uint64_t key);
+    void Grow();
 
-  enum class GameResult { UNDECIDED, WIN, LOSE };
+    std::vector<Entry> entries_;
+    int used_;
+  };
 
+  // Game record holding the board of the last position only. Earlier
+  // positions are kept as the move leading to them, what it takes to undo
+  // it and their key, and boards for them are rebuilt on demand.
   class PositionHistory {
   public:
     PositionHistory() = default;
     PositionHistory(const PositionHistory& other) = default;
 
-    const Position& Last() const { return positions_.back(); }
+    // Board of the last position.
+    const SokoBoard& Last() const { return board_; }
+
+    int GetLastRepetitions() const { return plies_.back().repetitions; }
+
+    // How many times the position at `idx` occurred before it.
+    int GetRepetitionsAt(int idx) const { return plies_[idx].repetitions; }
+
+    std::uint64_t GetHashAt(int idx) const { return plies_[idx].hash; }
 
-    const Position& GetPositionAt(int idx) const { return positions_[idx]; }
+    // Move played from position `idx - 1` to position `idx`.
+    Move GetMoveAt(int idx) const { return plies_[idx].move; }
 
-    void Trim(int size) {
-      positions_.erase(positions_.begin() + size, positions_.end());
-    }
+    // Board of the position at `idx`, rebuilt by taking moves back from the
+    // last one.
+    SokoBoard GetBoardAt(int idx) const;
 
-    int GetLength() const { return positions_.size(); }
+    // Turns `board`, which must hold the position at `idx`, into the one
+    // before it. Walks backwards through the history without rebuilding
+    // each board from the last.
+    void UndoMoveAt(int idx, SokoBoard* board) const;
+
+    void Trim(int size);
+
+    int GetLength() const { return plies_.size(); }
 
     void Reset(const SokoBoard& board);
 
     void Append(Move m);
 
-    GameResult ComputeGameResult() const;
+    // Result of the last position by the deadlock checks search applies,
+    // positions without legal moves in `mode` being lost. With
+    // `corral_detector`, proven corral deadlocks are lost as well, as they
+    // are in a search pruning them.
+    GameResult ComputeGameResult(
+      MoveMode mode, CorralDetector* corral_detector = nullptr) const;
 
   private:
-    int ComputeLastMoveRepetitions() const;
+    struct Ply {
+      std::uint64_t hash;
+      Move move;
+      SokoBoard::UndoInfo undo;
+      std::uint8_t repetitions;
+    };
 
-    std::vector<Position> positions_;
+    SokoBoard board_;
+    // One entry per position, the first one has no move.
+    std::vector<Ply> plies_;
+    // Keys of all positions, so repetitions are found without going
+    // through the history.
+    PositionKeyCounts keys_;
   };
   
 } // namespace pzero
@@ -1,6 +1,8 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 #include <string>
 #include <vector>
@@ -21,4 +23,22 @@ uint64_t GetFileSize(const std::string& filename);
 // Returns modification time of a file. Throws exception if file doesn't exist.
 time_t GetFileTime(const std::string& filename);
 
+// Read-only memory mapping of a whole file. Throws exception if the file
+// can't be opened or mapped.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+};
+
 }  // namespace pzero